@@ -0,0 +1,299 @@
+//
+//  bench.cpp
+//  pd-mi
+//
+
+// pd-mi-bench: runs every scenario of every external at block sizes 8..2048
+// and reports the cost of the perform routines as JSON.
+//
+// Each measurement creates a fresh object, warms it up for a quarter of the
+// measured time, then runs --repeat passes of --seconds of audio each. The
+// timed loop includes refilling the inlet vectors, as the upstream objects
+// would in Pd. ns_per_sample is the best pass, ns_per_sample_median the
+// median; cycles come from the time stamp counter where there is one, and
+// are null elsewhere.
+//
+// --rt-check also records what the perform routines shouldn't do (see
+// rt_check.h), prints it per measurement and fails the run if there is any.
+//
+//   pd-mi-bench [--externals DIR] [--filter TEXT] [--blocks 8,64,...]
+//               [--seconds S] [--repeat N] [--sr HZ] [--out FILE]
+//               [--rt-check] [-v]
+
+#include "pd_host.h"
+#include "rt_check.h"
+#include "scenarios.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_TSC 1
+#endif
+
+#ifndef PD_MI_EXTERNALS_DIR
+#define PD_MI_EXTERNALS_DIR "externals"
+#endif
+
+using namespace pdmi;
+
+struct t_options
+{
+    std::string externals = PD_MI_EXTERNALS_DIR;
+    std::string filter;
+    std::vector<int> blocks = {8, 16, 32, 64, 128, 256, 512, 1024, 2048};
+    double seconds = 1.0;
+    int repeat = 3;
+    float samplerate = 48000.f;
+    std::string out;
+    bool rt_check = false;
+    int verbosity = 1;
+};
+
+struct t_result
+{
+    const Scenario *scenario;
+    int block_size;
+    long ticks;
+    double ns_best;
+    double ns_median;
+    double cycles_best; // < 0: no cycle counter
+    int errors;
+    long rt_violations;
+};
+
+static inline unsigned long long read_cycles()
+{
+#ifdef BENCH_HAS_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: pd-mi-bench [--externals DIR] [--filter TEXT] [--blocks 8,64,...]\n"
+                    "                   [--seconds S] [--repeat N] [--sr HZ] [--out FILE]\n"
+                    "                   [--rt-check] [-v]\n");
+}
+
+static bool parse_options(int argc, char **argv, t_options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-v")
+            options.verbosity = 4;
+        else if (arg == "--rt-check")
+            options.rt_check = true;
+        else if (arg == "--externals" && has_value)
+            options.externals = argv[++i];
+        else if (arg == "--filter" && has_value)
+            options.filter = argv[++i];
+        else if (arg == "--seconds" && has_value)
+            options.seconds = atof(argv[++i]);
+        else if (arg == "--repeat" && has_value)
+            options.repeat = std::max(1, atoi(argv[++i]));
+        else if (arg == "--sr" && has_value)
+            options.samplerate = (float)atof(argv[++i]);
+        else if (arg == "--out" && has_value)
+            options.out = argv[++i];
+        else if (arg == "--blocks" && has_value)
+        {
+            options.blocks.clear();
+            for (char *token = strtok(argv[++i], ","); token; token = strtok(nullptr, ","))
+                if (atoi(token) > 0)
+                    options.blocks.push_back(atoi(token));
+        }
+        else
+            return false;
+    }
+    return !options.blocks.empty() && options.seconds > 0 && options.samplerate > 0;
+}
+
+static bool measure(const Scenario &scenario, int block_size, const t_options &options, t_result &result)
+{
+    int errors = host_error_count();
+    rt_check_reset();
+    ScenarioRunner runner(scenario, block_size);
+    if (!runner.ok())
+    {
+        fprintf(stderr, "%s: %s\n", scenario.id().c_str(), runner.error().c_str());
+        return false;
+    }
+
+    long ticks = std::max(1L, (long)(options.seconds * options.samplerate / block_size));
+    for (long t = 0; t < ticks / 4; ++t)
+        runner.Tick();
+
+    std::vector<double> ns(options.repeat);
+    double cycles_best = -1;
+    for (int pass = 0; pass < options.repeat; ++pass)
+    {
+        auto start = std::chrono::steady_clock::now();
+        unsigned long long cycles_start = read_cycles();
+        for (long t = 0; t < ticks; ++t)
+            runner.Tick();
+        unsigned long long cycles_end = read_cycles();
+        auto end = std::chrono::steady_clock::now();
+
+        double samples = (double)ticks * block_size;
+        ns[pass] = std::chrono::duration<double, std::nano>(end - start).count() / samples;
+#ifdef BENCH_HAS_TSC
+        double cycles = (double)(cycles_end - cycles_start) / samples;
+        if (cycles_best < 0 || cycles < cycles_best)
+            cycles_best = cycles;
+#endif
+    }
+    std::vector<double> sorted(ns);
+    std::sort(sorted.begin(), sorted.end());
+
+    result.scenario = &scenario;
+    result.block_size = block_size;
+    result.ticks = ticks;
+    result.ns_best = sorted.front();
+    result.ns_median = sorted[sorted.size() / 2];
+    result.cycles_best = cycles_best;
+    result.errors = host_error_count() - errors;
+
+    result.rt_violations = 0;
+    std::vector<RtViolation> violations = rt_check_report();
+    for (const RtViolation &v : violations)
+        result.rt_violations += v.count;
+    if (!violations.empty())
+    {
+        fprintf(stderr, "%s @%d: not real-time safe\n", scenario.id().c_str(), block_size);
+        rt_check_print(stderr, violations);
+    }
+    return true;
+}
+
+static void json_string(FILE *f, const std::string &s)
+{
+    fputc('"', f);
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            fputc('\\', f);
+        fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+static void write_json(FILE *f, const t_options &options, const std::vector<t_result> &results,
+                       const std::vector<std::string> &failures)
+{
+    fprintf(f, "{\n  \"harness\": \"pd-mi-bench\",\n");
+    fprintf(f, "  \"samplerate\": %g,\n  \"seconds\": %g,\n  \"repeat\": %d,\n",
+            options.samplerate, options.seconds, options.repeat);
+#ifdef BENCH_HAS_TSC
+    fprintf(f, "  \"cycle_counter\": \"tsc\",\n");
+#else
+    fprintf(f, "  \"cycle_counter\": null,\n");
+#endif
+    fprintf(f, "  \"failures\": [");
+    for (size_t i = 0; i < failures.size(); ++i)
+    {
+        fputs(i ? ", " : "", f);
+        json_string(f, failures[i]);
+    }
+    fprintf(f, "],\n  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const t_result &r = results[i];
+        double samples_per_second = 1e9 / r.ns_best;
+        fprintf(f, "    {\"external\": ");
+        json_string(f, r.scenario->external);
+        fprintf(f, ", \"scenario\": ");
+        json_string(f, r.scenario->name);
+        fprintf(f, ", \"block_size\": %d, \"channels\": %d, \"samples\": %ld", r.block_size,
+                r.scenario->channels, r.ticks * r.block_size);
+        fprintf(f, ", \"ns_per_sample\": %.3f, \"ns_per_sample_median\": %.3f", r.ns_best, r.ns_median);
+        if (r.cycles_best >= 0)
+            fprintf(f, ", \"cycles_per_sample\": %.2f", r.cycles_best);
+        else
+            fprintf(f, ", \"cycles_per_sample\": null");
+        fprintf(f, ", \"samples_per_second\": %.0f, \"realtime_factor\": %.2f, \"errors\": %d",
+                samples_per_second, samples_per_second / options.samplerate, r.errors);
+        if (options.rt_check)
+            fprintf(f, ", \"rt_violations\": %ld", r.rt_violations);
+        fprintf(f, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+    t_options options;
+    if (!parse_options(argc, argv, options))
+    {
+        usage();
+        return 2;
+    }
+    host_set_samplerate(options.samplerate);
+    host_set_verbosity(options.verbosity);
+    if (options.rt_check)
+    {
+        rt_check_enable(true);
+        if (!rt_check_hooks_installed())
+            fprintf(stderr, "rt check: no malloc and lock hooks on this platform, Pd API calls only\n");
+    }
+
+    std::vector<std::string> failures;
+    std::vector<std::string> loaded;
+    for (const std::string &name : all_externals())
+    {
+        std::string error;
+        if (host_load(options.externals, name, error))
+            loaded.push_back(name);
+        else
+        {
+            fprintf(stderr, "%s\n", error.c_str());
+            failures.push_back(error);
+        }
+    }
+    if (loaded.empty())
+        return 1;
+
+    std::vector<Scenario> scenarios = all_scenarios();
+    std::vector<t_result> results;
+    bool rt_safe = true;
+    for (const Scenario &scenario : scenarios)
+    {
+        if (std::find(loaded.begin(), loaded.end(), scenario.external) == loaded.end())
+            continue;
+        if (!options.filter.empty() && scenario.id().find(options.filter) == std::string::npos)
+            continue;
+        for (int block_size : options.blocks)
+        {
+            t_result result;
+            if (!measure(scenario, block_size, options, result))
+            {
+                failures.push_back(scenario.id());
+                break;
+            }
+            fprintf(stderr, "%-32s %5d  %8.1f ns/sample\n", scenario.id().c_str(), block_size, result.ns_best);
+            results.push_back(result);
+            rt_safe = rt_safe && result.rt_violations == 0;
+        }
+    }
+
+    FILE *f = options.out.empty() ? stdout : fopen(options.out.c_str(), "w");
+    if (!f)
+    {
+        perror(options.out.c_str());
+        return 1;
+    }
+    write_json(f, options, results, failures);
+    if (f != stdout)
+        fclose(f);
+    return failures.empty() && rt_safe ? 0 : 1;
+}
@@ -0,0 +1,489 @@
+//
+//  golden.cpp
+//  pd-mi
+//
+
+// pd-mi-golden: renders every scenario and compares the output against the
+// reference files in harness/golden, or rewrites them with --update.
+//
+// A reference keeps, per outlet and channel, the RMS of every 64 frame
+// window of the whole render and the last 1024 frames verbatim. The state
+// at the end depends on everything before it, so the tail catches changes
+// that average out in the envelope. A scenario passes if no value is
+// further than --tolerance from the reference (1e-4, -80 dBFS), or is
+// bit-identical with --exact.
+//
+// Every scenario runs in its own process, forked after the externals are
+// loaded, so it starts from the globals the externals had after setup (the
+// noise generators are seeded by instance count) whatever ran before it,
+// and a crash fails one scenario only.
+//
+// A few scenarios have no reference: they are compared with another
+// scenario's render instead (Scenario::matches), on the envelope only.
+//
+// With --rt-check the references are left alone: the scenarios are only
+// rendered, and fail if a perform routine does something that isn't real-
+// time safe (see rt_check.h).
+//
+// Exits 0 if all scenarios match, 1 on a mismatch or a missing reference,
+// 77 (skipped) if no external could be loaded.
+//
+// The committed references come from the baseline externals, the tree the
+// pd-mi changes started from: the golden_baseline target builds it in a git
+// worktree and runs --update against it, then --update --missing against
+// this tree's externals for the scenarios the baseline can't run (newer
+// messages and externals). A change that is meant to alter the output
+// rewrites the affected references with --update --filter.
+//
+//   pd-mi-golden [--update [--missing] | --rt-check] [--exact] [--tolerance T]
+//                [--externals DIR] [--golden DIR] [--filter TEXT]
+//                [--blocks 64,...] [--seconds S] [-v]
+
+#include "pd_host.h"
+#include "rt_check.h"
+#include "scenarios.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef PD_MI_EXTERNALS_DIR
+#define PD_MI_EXTERNALS_DIR "externals"
+#endif
+#ifndef PD_MI_GOLDEN_DIR
+#define PD_MI_GOLDEN_DIR "harness/golden"
+#endif
+
+using namespace pdmi;
+
+static const char kMagic[8] = {'P', 'D', 'M', 'I', 'G', 'L', 'D', '1'};
+static const size_t kWindow = 64;
+static const size_t kTail = 1024;
+static const float kSampleRate = 48000.f;
+
+enum
+{
+    RESULT_OK = 0,
+    RESULT_MISMATCH = 1,
+    RESULT_ERROR = 2,
+    RESULT_MISSING = 3,
+    RESULT_SKIPPED = 77
+};
+
+struct t_options
+{
+    std::string externals = PD_MI_EXTERNALS_DIR;
+    std::string golden = PD_MI_GOLDEN_DIR;
+    std::string filter;
+    std::vector<int> blocks = {64};
+    double seconds = 0.5;
+    double tolerance = 1e-4;
+    bool exact = false;
+    bool update = false;
+    bool missing = false; // with update: keep the references that exist
+    bool rt_check = false;
+    int verbosity = 1;
+};
+
+// envelope and tail of every outlet channel, in outlet order
+struct t_reference
+{
+    uint32_t samplerate = 0;
+    uint32_t block_size = 0;
+    uint32_t frames = 0;
+    uint32_t signals = 0;
+    std::vector<std::vector<float>> envelope;
+    std::vector<std::vector<float>> tail;
+};
+
+static void usage()
+{
+    fprintf(stderr, "usage: pd-mi-golden [--update [--missing] | --rt-check] [--exact] [--tolerance T]\n"
+                    "                    [--externals DIR] [--golden DIR] [--filter TEXT]\n"
+                    "                    [--blocks 64,...] [--seconds S] [-v]\n");
+}
+
+static bool parse_options(int argc, char **argv, t_options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-v")
+            options.verbosity = 4;
+        else if (arg == "--update")
+            options.update = true;
+        else if (arg == "--missing")
+            options.missing = true;
+        else if (arg == "--rt-check")
+            options.rt_check = true;
+        else if (arg == "--exact")
+            options.exact = true;
+        else if (arg == "--tolerance" && has_value)
+            options.tolerance = atof(argv[++i]);
+        else if (arg == "--externals" && has_value)
+            options.externals = argv[++i];
+        else if (arg == "--golden" && has_value)
+            options.golden = argv[++i];
+        else if (arg == "--filter" && has_value)
+            options.filter = argv[++i];
+        else if (arg == "--seconds" && has_value)
+            options.seconds = atof(argv[++i]);
+        else if (arg == "--blocks" && has_value)
+        {
+            options.blocks.clear();
+            for (char *token = strtok(argv[++i], ","); token; token = strtok(nullptr, ","))
+                if (atoi(token) > 0)
+                    options.blocks.push_back(atoi(token));
+        }
+        else
+            return false;
+    }
+    return !options.blocks.empty() && options.seconds > 0 && options.tolerance >= 0 &&
+           !(options.update && options.rt_check) && !(options.missing && !options.update);
+}
+
+// golden/pd.mi.plts~/engine_3@64.ref
+static std::string reference_path(const t_options &options, const Scenario &scenario, int block_size)
+{
+    std::string name = scenario.name;
+    std::replace(name.begin(), name.end(), ' ', '_');
+    return options.golden + "/" + scenario.external + "/" + name + "@" + std::to_string(block_size) + ".ref";
+}
+
+static bool render(const Scenario &scenario, int block_size, double seconds, t_reference &out, std::string &error)
+{
+    ScenarioRunner runner(scenario, block_size);
+    if (!runner.ok())
+    {
+        error = runner.error();
+        return false;
+    }
+    int outlets = host_signal_outlets(runner.object());
+    long ticks = std::max(1L, (long)(seconds * kSampleRate / block_size));
+
+    std::vector<std::vector<float>> signals;
+    for (long t = 0; t < ticks; ++t)
+    {
+        runner.Tick();
+        size_t signal = 0;
+        for (int o = 0; o < outlets; ++o)
+        {
+            int channels = 1;
+            const t_sample *vec = runner.chain().output(0, o, &channels);
+            for (int c = 0; c < channels; ++c, ++signal)
+            {
+                if (signal == signals.size())
+                    signals.emplace_back();
+                signals[signal].insert(signals[signal].end(), vec + c * block_size, vec + (c + 1) * block_size);
+            }
+        }
+    }
+
+    out.samplerate = (uint32_t)kSampleRate;
+    out.block_size = (uint32_t)block_size;
+    out.frames = (uint32_t)(ticks * block_size);
+    out.signals = (uint32_t)signals.size();
+    out.envelope.assign(signals.size(), {});
+    out.tail.assign(signals.size(), {});
+    for (size_t s = 0; s < signals.size(); ++s)
+    {
+        const std::vector<float> &x = signals[s];
+        for (size_t start = 0; start < x.size(); start += kWindow)
+        {
+            size_t end = std::min(x.size(), start + kWindow);
+            double sum = 0.0;
+            for (size_t i = start; i < end; ++i)
+                sum += (double)x[i] * x[i];
+            out.envelope[s].push_back((float)sqrt(sum / (end - start)));
+        }
+        out.tail[s].assign(x.end() - std::min(x.size(), kTail), x.end());
+    }
+    return true;
+}
+
+static bool write_reference(const std::string &path, const t_reference &r)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    uint32_t header[4] = {r.samplerate, r.block_size, r.frames, r.signals};
+    fwrite(kMagic, 1, sizeof(kMagic), f);
+    fwrite(header, sizeof(uint32_t), 4, f);
+    for (uint32_t s = 0; s < r.signals; ++s)
+    {
+        uint32_t sizes[2] = {(uint32_t)r.envelope[s].size(), (uint32_t)r.tail[s].size()};
+        fwrite(sizes, sizeof(uint32_t), 2, f);
+        fwrite(r.envelope[s].data(), sizeof(float), sizes[0], f);
+        fwrite(r.tail[s].data(), sizeof(float), sizes[1], f);
+    }
+    return fclose(f) == 0;
+}
+
+static bool read_reference(const std::string &path, t_reference &r)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+    char magic[8];
+    uint32_t header[4];
+    bool ok = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && !memcmp(magic, kMagic, sizeof(magic)) &&
+              fread(header, sizeof(uint32_t), 4, f) == 4;
+    if (ok)
+    {
+        r.samplerate = header[0];
+        r.block_size = header[1];
+        r.frames = header[2];
+        r.signals = header[3];
+        r.envelope.assign(r.signals, {});
+        r.tail.assign(r.signals, {});
+        for (uint32_t s = 0; ok && s < r.signals; ++s)
+        {
+            uint32_t sizes[2];
+            ok = fread(sizes, sizeof(uint32_t), 2, f) == 2 && sizes[0] <= r.frames && sizes[1] <= r.frames;
+            if (!ok)
+                break;
+            r.envelope[s].resize(sizes[0]);
+            r.tail[s].resize(sizes[1]);
+            ok = fread(r.envelope[s].data(), sizeof(float), sizes[0], f) == sizes[0] &&
+                 fread(r.tail[s].data(), sizeof(float), sizes[1], f) == sizes[1];
+        }
+    }
+    fclose(f);
+    return ok;
+}
+
+static bool make_dirs(const std::string &path)
+{
+    for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1))
+    {
+        std::string dir = path.substr(0, slash);
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+            return false;
+    }
+    return true;
+}
+
+// largest deviation, NaN counts as infinitely far
+static bool compare(const std::vector<float> &a, const std::vector<float> &b, const t_options &options,
+                    double &worst, size_t &where)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        if (options.exact ? memcmp(&a[i], &b[i], sizeof(float)) == 0 : fabs((double)a[i] - b[i]) <= options.tolerance)
+            continue;
+        double d = fabs((double)a[i] - b[i]);
+        if (!(d <= worst))
+        {
+            worst = std::isnan(d) ? INFINITY : d;
+            where = i;
+        }
+    }
+    return worst == 0.0 || (!options.exact && worst <= options.tolerance);
+}
+
+// a scenario with 'matches' is held to the envelope of the scenario it
+// names, rendered in the same process; the tails aren't compared, as the
+// two only have to sound alike
+static int run_match(const Scenario &scenario, int block_size, const t_reference &rendered,
+                     const t_options &options)
+{
+    std::string id = scenario.id() + " @" + std::to_string(block_size);
+    std::vector<Scenario> scenarios = all_scenarios();
+    auto other = std::find_if(scenarios.begin(), scenarios.end(), [&](const Scenario &s) {
+        return s.external == scenario.external && s.name == scenario.matches;
+    });
+    t_reference reference;
+    std::string error = "no scenario '" + scenario.matches + "'";
+    if (other == scenarios.end() || !render(*other, block_size, options.seconds, reference, error))
+    {
+        printf("ERROR    %s: %s\n", id.c_str(), error.c_str());
+        return RESULT_ERROR;
+    }
+    if (reference.signals != rendered.signals)
+    {
+        printf("FAIL     %s: %u signals, '%s' has %u\n", id.c_str(), rendered.signals, scenario.matches.c_str(),
+               reference.signals);
+        return RESULT_MISMATCH;
+    }
+
+    t_options match = options;
+    match.exact = false;
+    match.tolerance = scenario.match_tolerance;
+    bool ok = true;
+    for (uint32_t s = 0; s < rendered.signals; ++s)
+    {
+        double worst = 0.0;
+        size_t where = 0;
+        if (!compare(rendered.envelope[s], reference.envelope[s], match, worst, where))
+        {
+            printf("FAIL     %s: signal %u, envelope off from '%s' by %g at frame %zu\n", id.c_str(), s,
+                   scenario.matches.c_str(), worst, where * kWindow);
+            ok = false;
+        }
+    }
+    if (ok)
+        printf("ok       %s (like '%s')\n", id.c_str(), scenario.matches.c_str());
+    return ok ? RESULT_OK : RESULT_MISMATCH;
+}
+
+static int run_scenario(const Scenario &scenario, int block_size, const t_options &options)
+{
+    std::string id = scenario.id() + " @" + std::to_string(block_size);
+    std::string path = reference_path(options, scenario, block_size);
+
+    if (options.update && !scenario.matches.empty())
+    {
+        printf("skipped  %s: compared with '%s', no reference\n", id.c_str(), scenario.matches.c_str());
+        return RESULT_OK;
+    }
+
+    t_reference reference;
+    if (options.update && options.missing && read_reference(path, reference))
+    {
+        printf("kept     %s\n", id.c_str());
+        return RESULT_OK;
+    }
+
+    t_reference rendered;
+    std::string error;
+    if (!render(scenario, block_size, options.seconds, rendered, error))
+    {
+        printf("ERROR    %s: %s\n", id.c_str(), error.c_str());
+        return RESULT_ERROR;
+    }
+
+    if (options.rt_check)
+    {
+        std::vector<RtViolation> violations = rt_check_report();
+        if (violations.empty())
+        {
+            printf("ok       %s\n", id.c_str());
+            return RESULT_OK;
+        }
+        printf("RT       %s: not real-time safe\n", id.c_str());
+        rt_check_print(stdout, violations);
+        return RESULT_MISMATCH;
+    }
+
+    if (!scenario.matches.empty())
+        return run_match(scenario, block_size, rendered, options);
+
+    if (options.update)
+    {
+        if (!make_dirs(path) || !write_reference(path, rendered))
+        {
+            printf("ERROR    %s: can't write %s\n", id.c_str(), path.c_str());
+            return RESULT_ERROR;
+        }
+        printf("updated  %s\n", id.c_str());
+        return RESULT_OK;
+    }
+
+    if (!read_reference(path, reference))
+    {
+        printf("missing  %s (%s)\n", id.c_str(), path.c_str());
+        return RESULT_MISSING;
+    }
+    if (reference.frames != rendered.frames || reference.signals != rendered.signals ||
+        reference.samplerate != rendered.samplerate)
+    {
+        printf("FAIL     %s: %u signals x %u frames, reference has %u x %u\n", id.c_str(), rendered.signals,
+               rendered.frames, reference.signals, reference.frames);
+        return RESULT_MISMATCH;
+    }
+
+    bool ok = true;
+    for (uint32_t s = 0; s < rendered.signals; ++s)
+    {
+        double worst = 0.0;
+        size_t where = 0;
+        if (!compare(rendered.envelope[s], reference.envelope[s], options, worst, where))
+        {
+            printf("FAIL     %s: signal %u, envelope off by %g at frame %zu\n", id.c_str(), s, worst, where * kWindow);
+            ok = false;
+        }
+        worst = 0.0;
+        if (!compare(rendered.tail[s], reference.tail[s], options, worst, where))
+        {
+            printf("FAIL     %s: signal %u, tail off by %g at frame %zu\n", id.c_str(), s, worst,
+                   rendered.frames - rendered.tail[s].size() + where);
+            ok = false;
+        }
+    }
+    if (ok)
+        printf("ok       %s\n", id.c_str());
+    return ok ? RESULT_OK : RESULT_MISMATCH;
+}
+
+int main(int argc, char **argv)
+{
+    t_options options;
+    if (!parse_options(argc, argv, options))
+    {
+        usage();
+        return 2;
+    }
+    host_set_samplerate(kSampleRate);
+    host_set_verbosity(options.verbosity);
+    rt_check_enable(options.rt_check);
+
+    std::vector<std::string> loaded;
+    for (const std::string &name : all_externals())
+    {
+        std::string error;
+        if (host_load(options.externals, name, error))
+            loaded.push_back(name);
+        else
+            fprintf(stderr, "%s\n", error.c_str());
+    }
+    if (loaded.empty())
+    {
+        fprintf(stderr, "no externals in %s, skipping\n", options.externals.c_str());
+        return RESULT_SKIPPED;
+    }
+
+    int counts[4] = {0, 0, 0, 0};
+    for (const Scenario &scenario : all_scenarios())
+    {
+        if (std::find(loaded.begin(), loaded.end(), scenario.external) == loaded.end())
+            continue;
+        if (!options.filter.empty() && scenario.id().find(options.filter) == std::string::npos)
+            continue;
+        for (int block_size : options.blocks)
+        {
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0)
+                exit(run_scenario(scenario, block_size, options));
+
+            int status = 0;
+            int result = RESULT_ERROR;
+            if (pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status))
+                result = WEXITSTATUS(status);
+            else
+                printf("CRASH    %s @%d\n", scenario.id().c_str(), block_size);
+            counts[result <= RESULT_MISSING ? result : RESULT_ERROR]++;
+        }
+    }
+
+    int total = counts[0] + counts[1] + counts[2] + counts[3];
+    printf("%d ok, %d failed, %d errors, %d missing\n", counts[RESULT_OK], counts[RESULT_MISMATCH],
+           counts[RESULT_ERROR], counts[RESULT_MISSING]);
+    if (counts[RESULT_MISSING] > 0)
+        printf("no reference for %d renders in %s, write them with the golden_baseline target\n",
+               counts[RESULT_MISSING], options.golden.c_str());
+    return counts[RESULT_OK] == total ? 0 : 1;
+}
@@ -0,0 +1,50 @@
+# Writes the golden references from the baseline externals, run by the
+# golden_baseline target (cmake -P, see CMakeLists.txt):
+#
+#   SOURCE_DIR  this repository
+#   WORK_DIR    scratch space for the baseline worktree and its build
+#   BASELINE    the commit to render from
+#   GOLDEN      the pd-mi-golden executable
+#
+# The baseline is checked out into a git worktree and built with its own
+# CMakeLists, then rendered with --update. Scenarios it can't run (messages
+# and externals added since) are rendered from this tree's externals with
+# --update --missing, which keeps the baseline's references.
+
+foreach (variable SOURCE_DIR WORK_DIR BASELINE GOLDEN)
+	if (NOT DEFINED ${variable})
+		message(FATAL_ERROR "golden_baseline.cmake: ${variable} is not set")
+	endif ()
+endforeach ()
+
+set(WORKTREE ${WORK_DIR}/golden-baseline)
+
+function(remove_worktree)
+	execute_process(COMMAND git -C ${SOURCE_DIR} worktree remove --force ${WORKTREE} OUTPUT_QUIET ERROR_QUIET)
+	file(REMOVE_RECURSE ${WORKTREE})
+endfunction()
+
+# stops on the first failing command, without leaving the worktree behind
+function(run)
+	execute_process(COMMAND ${ARGN} RESULT_VARIABLE result)
+	if (result)
+		remove_worktree()
+		string(REPLACE ";" " " command "${ARGN}")
+		message(FATAL_ERROR "golden_baseline: '${command}' failed (${result})")
+	endif ()
+endfunction()
+
+remove_worktree()
+run(git -C ${SOURCE_DIR} worktree add --detach ${WORKTREE} ${BASELINE})
+
+run(${CMAKE_COMMAND} -S ${WORKTREE} -B ${WORKTREE}/build -DCMAKE_BUILD_TYPE=Release)
+run(${CMAKE_COMMAND} --build ${WORKTREE}/build --parallel)
+
+# errors for the scenarios the baseline doesn't support are expected here
+message(STATUS "golden_baseline: rendering ${BASELINE}")
+execute_process(COMMAND ${GOLDEN} --update --externals ${WORKTREE}/externals)
+
+message(STATUS "golden_baseline: rendering the scenarios ${BASELINE} can't run from this tree")
+run(${GOLDEN} --update --missing)
+
+remove_worktree()
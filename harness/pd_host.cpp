@@ -0,0 +1,743 @@
+//
+//  pd_host.cpp
+//  pd-mi
+//
+
+#include "pd_host.h"
+#include "rt_check.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+
+#include <dlfcn.h>
+
+#pragma mark----- host state -----
+
+// Pd's unit of logical time, 1 ms = 32 * 441 units
+static const double kTimeUnitsPerMs = 32.0 * 441.0;
+
+namespace
+{
+
+struct t_method_entry
+{
+    t_symbol *selector;
+    t_method fn;
+    std::vector<t_atomtype> args;
+};
+
+} // namespace
+
+struct _class
+{
+    t_symbol *name;
+    t_newmethod newmethod;
+    t_method freemethod;
+    size_t size;
+    int flags;
+    int signal_onset; // offset of the main signal inlet's float, -1: none
+    std::vector<t_method_entry> methods;
+};
+
+struct _inlet
+{
+    t_object *owner;
+    t_inlet *next;
+    t_float value;
+};
+
+struct _outlet
+{
+    t_object *owner;
+    t_outlet *next;
+    t_symbol *type;
+};
+
+namespace
+{
+
+struct t_host
+{
+    t_float samplerate = 48000;
+    int verbosity = 1;
+    int errors = 0;
+    double logical_time = 0;
+    bool dsp_dirty = false;
+
+    std::map<std::string, std::unique_ptr<t_symbol>> symbols;
+    std::vector<std::unique_ptr<t_class>> classes;
+    std::map<std::string, t_class *> creators; // class and creator names
+    std::map<std::string, void *> libraries;
+    pdmi::t_outlet_hook outlet_hook;
+
+    // set while a chain calls the dsp methods
+    std::vector<t_int> *program = nullptr;
+    pdmi::DspChain::Node *node = nullptr;
+};
+
+t_host &host()
+{
+    static t_host instance;
+    return instance;
+}
+
+void host_vpost(int level, const char *prefix, const char *fmt, va_list ap)
+{
+    pdmi::rt_check_note(pdmi::RT_POST, 3);
+    pdmi::RtUnchecked unchecked;
+    if (level > host().verbosity)
+        return;
+    fputs(prefix, stderr);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+}
+
+} // namespace
+
+struct pdmi::DspChain::Node
+{
+    t_object *object;
+    int in_channels;
+    int inlets;
+    int outlets;
+    std::vector<std::vector<t_sample>> buffers; // owned signal memory
+    std::vector<std::unique_ptr<t_signal>> signals;
+    std::vector<t_signal *> sp; // inlets then outlets, as passed to dsp
+
+    t_signal *NewSignal(int n, int channels)
+    {
+        buffers.emplace_back(size_t(n) * channels, 0.f);
+        signals.emplace_back(new t_signal());
+        t_signal *sig = signals.back().get();
+        sig->s_n = n;
+        sig->s_vec = buffers.back().data();
+        sig->s_sr = host().samplerate;
+#ifdef CLASS_MULTICHANNEL
+        sig->s_nchans = channels;
+#endif
+        return sig;
+    }
+};
+
+#pragma mark----- m_pd.h -----
+
+extern "C"
+{
+    t_symbol s_pointer = {"pointer", 0, 0};
+    t_symbol s_float = {"float", 0, 0};
+    t_symbol s_symbol = {"symbol", 0, 0};
+    t_symbol s_bang = {"bang", 0, 0};
+    t_symbol s_list = {"list", 0, 0};
+    t_symbol s_anything = {"anything", 0, 0};
+    t_symbol s_signal = {"signal", 0, 0};
+    t_symbol s__N = {"#N", 0, 0};
+    t_symbol s__X = {"#X", 0, 0};
+    t_symbol s_x = {"x", 0, 0};
+    t_symbol s_y = {"y", 0, 0};
+    t_symbol s_ = {"", 0, 0};
+
+    t_symbol *gensym(const char *s)
+    {
+        static t_symbol *builtin[] = {&s_pointer, &s_float, &s_symbol, &s_bang, &s_list, &s_anything,
+                                      &s_signal, &s__N, &s__X, &s_x, &s_y, &s_};
+        for (t_symbol *sym : builtin)
+            if (strcmp(sym->s_name, s) == 0)
+                return sym;
+
+        auto &symbols = host().symbols;
+        auto found = symbols.emplace(s, nullptr).first;
+        if (!found->second)
+        {
+            found->second.reset(new t_symbol());
+            found->second->s_name = found->first.c_str();
+        }
+        return found->second.get();
+    }
+
+    void *getbytes(size_t nbytes)
+    {
+        pdmi::rt_check_note(pdmi::RT_GETBYTES);
+        pdmi::RtUnchecked unchecked;
+        return calloc(nbytes ? nbytes : 1, 1);
+    }
+
+    void *resizebytes(void *x, size_t oldsize, size_t newsize)
+    {
+        pdmi::rt_check_note(pdmi::RT_GETBYTES);
+        pdmi::RtUnchecked unchecked;
+        void *y = realloc(x, newsize ? newsize : 1);
+        if (y && newsize > oldsize)
+            memset((char *)y + oldsize, 0, newsize - oldsize);
+        return y;
+    }
+
+    void freebytes(void *x, size_t nbytes)
+    {
+        pdmi::rt_check_note(pdmi::RT_FREEBYTES);
+        pdmi::RtUnchecked unchecked;
+        free(x);
+    }
+
+    void post(const char *fmt, ...)
+    {
+        va_list ap;
+        va_start(ap, fmt);
+        host_vpost(2, "", fmt, ap);
+        va_end(ap);
+    }
+
+    void startpost(const char *fmt, ...)
+    {
+        va_list ap;
+        va_start(ap, fmt);
+        host_vpost(2, "", fmt, ap);
+        va_end(ap);
+    }
+
+    void endpost(void)
+    {
+    }
+
+    void logpost(const void *object, int level, const char *fmt, ...)
+    {
+        va_list ap;
+        va_start(ap, fmt);
+        host_vpost(level, "", fmt, ap);
+        va_end(ap);
+    }
+
+    void verbose(int level, const char *fmt, ...)
+    {
+        va_list ap;
+        va_start(ap, fmt);
+        host_vpost(4, "verbose: ", fmt, ap);
+        va_end(ap);
+    }
+
+    void pd_error(const void *object, const char *fmt, ...)
+    {
+        host().errors++;
+        va_list ap;
+        va_start(ap, fmt);
+        host_vpost(1, "error: ", fmt, ap);
+        va_end(ap);
+    }
+
+    t_class *class_new(t_symbol *name, t_newmethod newmethod, t_method freemethod,
+                       size_t size, int flags, t_atomtype arg1, ...)
+    {
+        t_class *c = new t_class();
+        c->name = name;
+        c->newmethod = newmethod;
+        c->freemethod = freemethod;
+        c->size = size;
+        c->flags = flags;
+        c->signal_onset = -1;
+        host().classes.emplace_back(c);
+        host().creators[name->s_name] = c;
+        return c;
+    }
+
+    void class_addcreator(t_newmethod newmethod, t_symbol *s, t_atomtype type1, ...)
+    {
+        // the externals register their own new method, so the last class
+        // created is the one this creates
+        if (!host().classes.empty())
+            host().creators[s->s_name] = host().classes.back().get();
+    }
+
+    void class_addmethod(t_class *c, t_method fn, t_symbol *sel, t_atomtype arg1, ...)
+    {
+        t_method_entry entry = {sel, fn, {}};
+        va_list ap;
+        va_start(ap, arg1);
+        for (t_atomtype type = arg1; type != A_NULL; type = (t_atomtype)va_arg(ap, int))
+        {
+            entry.args.push_back(type);
+            if (type == A_GIMME || type == A_CANT)
+                break;
+        }
+        va_end(ap);
+        c->methods.push_back(entry);
+    }
+
+    void class_domainsignalin(t_class *c, int onset)
+    {
+        c->signal_onset = onset;
+    }
+
+    void class_sethelpsymbol(t_class *c, t_symbol *s)
+    {
+    }
+
+    t_pd *pd_new(t_class *cls)
+    {
+        t_pd *x = (t_pd *)getbytes(cls->size);
+        *x = cls;
+        return x;
+    }
+
+    t_inlet *signalinlet_new(t_object *owner, t_float f)
+    {
+        t_inlet *inlet = new t_inlet{owner, nullptr, f};
+        t_inlet **tail = &owner->te_inlet;
+        while (*tail)
+            tail = &(*tail)->next;
+        *tail = inlet;
+        return inlet;
+    }
+
+    void inlet_free(t_inlet *x)
+    {
+        for (t_inlet **i = &x->owner->te_inlet; *i; i = &(*i)->next)
+        {
+            if (*i == x)
+            {
+                *i = x->next;
+                break;
+            }
+        }
+        delete x;
+    }
+
+    t_outlet *outlet_new(t_object *owner, t_symbol *s)
+    {
+        t_outlet *outlet = new t_outlet{owner, nullptr, s};
+        t_outlet **tail = &owner->te_outlet;
+        while (*tail)
+            tail = &(*tail)->next;
+        *tail = outlet;
+        return outlet;
+    }
+
+    void outlet_free(t_outlet *x)
+    {
+        for (t_outlet **o = &x->owner->te_outlet; *o; o = &(*o)->next)
+        {
+            if (*o == x)
+            {
+                *o = x->next;
+                break;
+            }
+        }
+        delete x;
+    }
+
+    void outlet_anything(t_outlet *x, t_symbol *s, int argc, t_atom *argv)
+    {
+        if (!host().outlet_hook)
+            return;
+        int index = 0;
+        for (t_outlet *o = x->owner->te_outlet; o && o != x; o = o->next)
+            index++;
+        host().outlet_hook(x->owner, index, s, argc, argv);
+    }
+
+    void outlet_list(t_outlet *x, t_symbol *s, int argc, t_atom *argv)
+    {
+        outlet_anything(x, &s_list, argc, argv);
+    }
+
+    void outlet_float(t_outlet *x, t_float f)
+    {
+        t_atom a;
+        SETFLOAT(&a, f);
+        outlet_anything(x, &s_float, 1, &a);
+    }
+
+    t_float atom_getfloat(const t_atom *a)
+    {
+        return a->a_type == A_FLOAT ? a->a_w.w_float : 0;
+    }
+
+    t_symbol *atom_getsymbol(const t_atom *a)
+    {
+        return a->a_type == A_SYMBOL ? a->a_w.w_symbol : &s_;
+    }
+
+    t_float atom_getfloatarg(int which, int argc, const t_atom *argv)
+    {
+        return which >= 0 && which < argc ? atom_getfloat(argv + which) : 0;
+    }
+
+    t_symbol *atom_getsymbolarg(int which, int argc, const t_atom *argv)
+    {
+        return which >= 0 && which < argc ? atom_getsymbol(argv + which) : &s_;
+    }
+
+    t_float sys_getsr(void)
+    {
+        return host().samplerate;
+    }
+
+    int sys_getblksize(void)
+    {
+        return 64;
+    }
+
+    double clock_getlogicaltime(void)
+    {
+        return host().logical_time;
+    }
+
+    double clock_gettimesince(double prevsystime)
+    {
+        return (host().logical_time - prevsystime) / kTimeUnitsPerMs;
+    }
+
+    void canvas_update_dsp(void)
+    {
+        host().dsp_dirty = true;
+    }
+
+    void dsp_add(t_perfroutine f, int n, ...)
+    {
+        std::vector<t_int> *program = host().program;
+        if (!program)
+            return;
+        program->push_back((t_int)f);
+        va_list ap;
+        va_start(ap, n);
+        for (int i = 0; i < n; i++)
+            program->push_back(va_arg(ap, t_int));
+        va_end(ap);
+    }
+
+    void signal_setmultiout(t_signal **sig, int nchans)
+    {
+        pdmi::DspChain::Node *node = host().node;
+        if (node && nchans > 0)
+            *sig = node->NewSignal((*sig)->s_n, nchans);
+    }
+}
+
+#pragma mark----- loader -----
+
+namespace pdmi
+{
+
+void host_set_samplerate(t_float sr)
+{
+    host().samplerate = sr;
+}
+
+t_float host_samplerate()
+{
+    return host().samplerate;
+}
+
+void host_set_verbosity(int level)
+{
+    host().verbosity = level;
+}
+
+int host_error_count()
+{
+    return host().errors;
+}
+
+// Pd's name for the setup function: "pd.mi.plts~" -> setup_pd0x2emi0x2eplts_tilde
+static std::string setup_name(const std::string &name)
+{
+    std::string mangled;
+    bool hex = false;
+    for (size_t i = 0; i < name.size(); i++)
+    {
+        char c = name[i];
+        if (c == '~' && i == name.size() - 1)
+            mangled += "_tilde";
+        else if (isalnum((unsigned char)c) || c == '_')
+            mangled += c;
+        else
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "0x%02x", (unsigned char)c);
+            mangled += buf;
+            hex = true;
+        }
+    }
+    return hex ? "setup_" + mangled : mangled + "_setup";
+}
+
+bool host_load(const std::string &dir, const std::string &name, std::string &error)
+{
+    if (host().libraries.count(name))
+        return true;
+
+    static const char *extensions[] = {
+#if defined(__APPLE__)
+        ".d_fat", ".d_amd64", ".d_arm64", ".pd_darwin", ".so",
+#else
+        ".l_amd64", ".l_arm64", ".pd_linux", ".so",
+#endif
+    };
+    std::string tried;
+    void *library = nullptr;
+    for (const char *extension : extensions)
+    {
+        std::string path = dir + "/" + name + extension;
+        library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (library)
+            break;
+        const char *reason = dlerror();
+        if (reason && !strstr(reason, "No such file"))
+            tried += std::string("\n  ") + reason;
+    }
+    if (!library)
+    {
+        error = "can't load " + name + " from " + dir + tried;
+        return false;
+    }
+
+    std::string symbol = setup_name(name);
+    void (*setup)(void) = (void (*)(void))dlsym(library, symbol.c_str());
+    if (!setup)
+    {
+        error = name + ": no " + symbol + "()";
+        dlclose(library);
+        return false;
+    }
+    setup();
+    host().libraries[name] = library;
+    if (!host().creators.count(name))
+    {
+        error = name + ": setup didn't create the class";
+        return false;
+    }
+    return true;
+}
+
+std::vector<t_atom> host_parse(const std::string &text)
+{
+    std::vector<t_atom> atoms;
+    std::istringstream words(text);
+    std::string word;
+    while (words >> word)
+    {
+        t_atom a;
+        char *end = nullptr;
+        double f = strtod(word.c_str(), &end);
+        if (end && *end == 0)
+            SETFLOAT(&a, (t_float)f);
+        else
+            SETSYMBOL(&a, gensym(word.c_str()));
+        atoms.push_back(a);
+    }
+    return atoms;
+}
+
+t_object *host_new(const std::string &name, const std::vector<t_atom> &args)
+{
+    auto found = host().creators.find(name);
+    if (found == host().creators.end())
+        return nullptr;
+    typedef void *(*t_gimme_new)(t_symbol *s, int argc, t_atom *argv);
+    std::vector<t_atom> argv(args);
+    return (t_object *)((t_gimme_new)found->second->newmethod)(gensym(name.c_str()), (int)argv.size(), argv.data());
+}
+
+void host_free(t_object *x)
+{
+    if (!x)
+        return;
+    t_class *c = *(t_pd *)x;
+    if (c->freemethod)
+        ((void (*)(t_object *))c->freemethod)(x);
+    while (x->te_inlet)
+        inlet_free(x->te_inlet);
+    while (x->te_outlet)
+        outlet_free(x->te_outlet);
+    freebytes(x, c->size);
+}
+
+static t_method_entry *find_method(t_object *x, t_symbol *selector)
+{
+    t_class *c = *(t_pd *)x;
+    for (t_method_entry &m : c->methods)
+        if (m.selector == selector)
+            return &m;
+    return nullptr;
+}
+
+bool host_send(t_object *x, const std::string &message)
+{
+    std::vector<t_atom> atoms = host_parse(message);
+    if (atoms.empty() || atoms[0].a_type != A_SYMBOL)
+        return false;
+    t_symbol *selector = atoms[0].a_w.w_symbol;
+    atoms.erase(atoms.begin());
+    return host_send(x, selector, atoms);
+}
+
+// Pd's calling convention: pointer arguments first, then the floats, with
+// all five float slots passed whether the method takes them or not
+bool host_send(t_object *x, t_symbol *selector, const std::vector<t_atom> &args)
+{
+    t_method_entry *m = find_method(x, selector);
+    if (!m || (!m->args.empty() && m->args[0] == A_CANT))
+        return false;
+
+    std::vector<t_atom> argv(args);
+    if (!m->args.empty() && m->args[0] == A_GIMME)
+    {
+        typedef void (*t_gimme)(t_object *, t_symbol *, int, t_atom *);
+        ((t_gimme)m->fn)(x, selector, (int)argv.size(), argv.data());
+        return true;
+    }
+
+    t_int ai[6] = {(t_int)x};
+    int ni = 1;
+    t_floatarg ad[5] = {0};
+    int nd = 0;
+    size_t next = 0;
+    for (t_atomtype type : m->args)
+    {
+        const t_atom *a = next < argv.size() ? &argv[next++] : nullptr;
+        switch (type)
+        {
+        case A_FLOAT:
+        case A_DEFFLOAT:
+            if (nd < 5)
+                ad[nd++] = a ? atom_getfloat(a) : 0;
+            break;
+        case A_SYMBOL:
+        case A_DEFSYM:
+            if (ni < 6)
+                ai[ni++] = (t_int)(a ? atom_getsymbol(a) : &s_);
+            break;
+        default:
+            break;
+        }
+    }
+
+    typedef t_floatarg F;
+    switch (ni)
+    {
+    case 1:
+        ((void (*)(t_int, F, F, F, F, F))m->fn)(ai[0], ad[0], ad[1], ad[2], ad[3], ad[4]);
+        break;
+    case 2:
+        ((void (*)(t_int, t_int, F, F, F, F, F))m->fn)(ai[0], ai[1], ad[0], ad[1], ad[2], ad[3], ad[4]);
+        break;
+    case 3:
+        ((void (*)(t_int, t_int, t_int, F, F, F, F, F))m->fn)(ai[0], ai[1], ai[2], ad[0], ad[1], ad[2], ad[3], ad[4]);
+        break;
+    default:
+        ((void (*)(t_int, t_int, t_int, t_int, F, F, F, F, F))m->fn)(ai[0], ai[1], ai[2], ai[3], ad[0], ad[1], ad[2], ad[3], ad[4]);
+        break;
+    }
+    return true;
+}
+
+int host_signal_inlets(t_object *x)
+{
+    t_class *c = *(t_pd *)x;
+    int n = c->signal_onset >= 0 ? 1 : 0;
+    for (t_inlet *i = x->te_inlet; i; i = i->next)
+        n++;
+    return n;
+}
+
+int host_signal_outlets(t_object *x)
+{
+    int n = 0;
+    for (t_outlet *o = x->te_outlet; o; o = o->next)
+        if (o->type == &s_signal)
+            n++;
+    return n;
+}
+
+void host_set_outlet_hook(t_outlet_hook hook)
+{
+    host().outlet_hook = hook;
+}
+
+#pragma mark----- dsp chain -----
+
+DspChain::DspChain(int block_size) : block_size_(block_size)
+{
+}
+
+DspChain::~DspChain()
+{
+}
+
+void DspChain::Add(t_object *x, int in_channels)
+{
+    Node *node = new Node();
+    node->object = x;
+    node->in_channels = in_channels;
+    node->inlets = host_signal_inlets(x);
+    node->outlets = host_signal_outlets(x);
+    for (int i = 0; i < node->inlets; i++)
+        node->NewSignal(block_size_, in_channels);
+    nodes_.emplace_back(node);
+}
+
+void DspChain::Start()
+{
+    program_.clear();
+    host().program = &program_;
+    for (auto &node : nodes_)
+    {
+        // inlets keep their signals across restarts, outlets are renewed
+        node->buffers.resize(node->inlets);
+        node->signals.resize(node->inlets);
+        for (int i = 0; i < node->outlets; i++)
+            node->NewSignal(block_size_, 1);
+        node->sp.clear();
+        for (auto &sig : node->signals)
+            node->sp.push_back(sig.get());
+
+        t_method_entry *dsp = find_method(node->object, gensym("dsp"));
+        host().node = node.get();
+        if (dsp)
+            ((void (*)(t_object *, t_signal **))dsp->fn)(node->object, node->sp.data());
+    }
+    host().node = nullptr;
+    host().program = nullptr;
+    host().dsp_dirty = false;
+    program_.push_back(0);
+}
+
+void DspChain::Tick()
+{
+    if (host().dsp_dirty || program_.empty())
+        Start();
+    RtScope scope;
+    t_int *pc = program_.data();
+    while (*pc)
+        pc = ((t_perfroutine)*pc)(pc);
+    host().logical_time += kTimeUnitsPerMs * 1000.0 * block_size_ / host().samplerate;
+}
+
+size_t DspChain::size() const
+{
+    return nodes_.size();
+}
+
+t_sample *DspChain::input(size_t object, int inlet)
+{
+    return nodes_[object]->signals[inlet]->s_vec;
+}
+
+const t_sample *DspChain::output(size_t object, int outlet, int *channels) const
+{
+    const Node *node = nodes_[object].get();
+    t_signal *sig = node->sp[node->inlets + outlet];
+    if (channels)
+    {
+#ifdef CLASS_MULTICHANNEL
+        *channels = sig->s_nchans;
+#else
+        *channels = 1;
+#endif
+    }
+    return sig->s_vec;
+}
+
+} // namespace pdmi
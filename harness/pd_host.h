@@ -0,0 +1,97 @@
+//
+//  pd_host.h
+//  pd-mi
+//
+
+// A minimal Pd host, for running the externals outside of Pd.
+//
+// pd_host.cpp implements the part of the m_pd.h API the externals use, a
+// loader that dlopen()s a built external and calls its setup function like
+// Pd does, and a DSP chain that calls the dsp methods and then runs the
+// perform routines block by block. The externals are loaded from the
+// directory they are built into, so whatever runs here is exactly the
+// binary that ships.
+//
+// Like Pd, the host is single threaded and keeps its state in globals.
+// Console output (post, logpost, pd_error, ...) goes to stderr, filtered by
+// host_set_verbosity(); pd_error() calls are counted either way.
+
+#ifndef PD_MI_PD_HOST_H_
+#define PD_MI_PD_HOST_H_
+
+#include <m_pd.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pdmi
+{
+
+// sample rate reported by sys_getsr(), set before creating objects
+void host_set_samplerate(t_float sr);
+t_float host_samplerate();
+
+// Pd log levels: 0 fatal, 1 error, 2 normal (post), 3 debug, 4 all (verbose)
+void host_set_verbosity(int level);
+int host_error_count();
+
+// loads <dir>/<name>.<extension> and calls its setup function, once per name
+bool host_load(const std::string &dir, const std::string &name, std::string &error);
+
+// "@engine 3 foo" -> float and symbol atoms
+std::vector<t_atom> host_parse(const std::string &text);
+
+t_object *host_new(const std::string &name, const std::vector<t_atom> &args);
+void host_free(t_object *x);
+
+// sends "selector args..." to the object, false if it has no such method
+bool host_send(t_object *x, const std::string &message);
+bool host_send(t_object *x, t_symbol *selector, const std::vector<t_atom> &args);
+
+// signal inlets including the main one, and signal outlets
+int host_signal_inlets(t_object *x);
+int host_signal_outlets(t_object *x);
+
+// called for every message an object sends through one of its outlets
+typedef std::function<void(t_object *x, int outlet, t_symbol *s, int argc, t_atom *argv)> t_outlet_hook;
+void host_set_outlet_hook(t_outlet_hook hook);
+
+// The objects added to a chain are run in order on every Tick(), like a Pd
+// canvas with everything connected to sig~ inputs and nothing downstream.
+// Inputs are written between ticks through input(), outputs read through
+// output(). If an object calls canvas_update_dsp(), the chain restarts DSP
+// before the next tick, as Pd would.
+class DspChain
+{
+public:
+    explicit DspChain(int block_size);
+    ~DspChain();
+
+    // in_channels > 1 makes multichannel inputs, for CLASS_MULTICHANNEL objects
+    void Add(t_object *x, int in_channels = 1);
+
+    // calls the dsp methods, again if already started
+    void Start();
+    void Tick();
+
+    int block_size() const { return block_size_; }
+    size_t size() const;
+
+    // in_channels * block_size samples
+    t_sample *input(size_t object, int inlet);
+    // channels * block_size samples
+    const t_sample *output(size_t object, int outlet, int *channels = nullptr) const;
+
+    struct Node;
+
+private:
+    int block_size_;
+    std::vector<std::unique_ptr<Node>> nodes_;
+    std::vector<t_int> program_;
+};
+
+} // namespace pdmi
+
+#endif // PD_MI_PD_HOST_H_
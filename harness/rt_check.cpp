@@ -0,0 +1,364 @@
+//
+//  rt_check.cpp
+//  pd-mi
+//
+
+#include "rt_check.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <utility>
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+
+#if defined(__GLIBC__)
+#include <cerrno>
+#include <pthread.h>
+#define RT_CHECK_HOOKS 1
+#endif
+
+using namespace pdmi;
+
+namespace
+{
+
+const int kMaxFrames = 24;
+const int kTableSize = 1024;
+
+struct t_record
+{
+    RtOperation operation;
+    uint64_t hash;
+    long count; // 0: free slot
+    int frames;
+    void *stack[kMaxFrames];
+};
+
+// Plain globals and no constructors: the hooks run from the first malloc
+// on, before any static initialisation. The harness calls the perform
+// routines from one thread.
+bool rt_enabled = false;
+int rt_depth = 0; // RtScope nesting
+int rt_quiet = 0; // RtUnchecked nesting, and while recording
+t_record rt_table[kTableSize];
+int rt_used = 0;
+long rt_dropped = 0;
+
+inline bool rt_checking()
+{
+    return rt_enabled && rt_depth > 0 && rt_quiet == 0;
+}
+
+const char *module_name(const char *path)
+{
+    const char *slash = path ? strrchr(path, '/') : nullptr;
+    return slash ? slash + 1 : (path ? path : "?");
+}
+
+// Not the harness and not a system library (lib*.so, ld-linux, the vdso):
+// the externals are called pd.mi.<name>~.<extension>.
+bool is_external(const Dl_info &info)
+{
+    static Dl_info self = {};
+    if (!self.dli_fname)
+        dladdr((void *)&module_name, &self);
+    if (!info.dli_fname || (self.dli_fname && !strcmp(info.dli_fname, self.dli_fname)))
+        return false;
+    const char *name = module_name(info.dli_fname);
+    return strncmp(name, "lib", 3) != 0 && strncmp(name, "ld-", 3) != 0 && strncmp(name, "linux-", 6) != 0;
+}
+
+// "myObj_perform(long*)+0x4c (pd.mi.wrps~.pd_linux+0x1a2b4)"
+std::string frame_name(void *address)
+{
+    char buf[64];
+    Dl_info info;
+    if (!dladdr(address, &info))
+    {
+        snprintf(buf, sizeof(buf), "%p", address);
+        return buf;
+    }
+    std::string name;
+    if (info.dli_sname)
+    {
+        int status = 0;
+        char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        name = status == 0 && demangled ? demangled : info.dli_sname;
+        free(demangled);
+        snprintf(buf, sizeof(buf), "+0x%lx", (unsigned long)((char *)address - (char *)info.dli_saddr));
+        name += buf;
+    }
+    else
+        name = "??";
+    snprintf(buf, sizeof(buf), "+0x%lx)", (unsigned long)((char *)address - (char *)info.dli_fbase));
+    return name + " (" + module_name(info.dli_fname) + buf;
+}
+
+} // namespace
+
+#pragma mark----- interface -----
+
+namespace pdmi
+{
+
+const char *rt_operation_name(RtOperation operation)
+{
+    static const char *names[RT_LAST] = {"malloc", "free", "lock", "getbytes", "freebytes", "post"};
+    return operation >= 0 && operation < RT_LAST ? names[operation] : "?";
+}
+
+void rt_check_enable(bool on)
+{
+    if (on)
+    {
+        // the first backtrace() loads the unwinder, which allocates
+        void *stack[4];
+        backtrace(stack, 4);
+        Dl_info info = {};
+        is_external(info);
+    }
+    rt_enabled = on;
+}
+
+bool rt_check_enabled()
+{
+    return rt_enabled;
+}
+
+bool rt_check_hooks_installed()
+{
+#ifdef RT_CHECK_HOOKS
+    return true;
+#else
+    return false;
+#endif
+}
+
+RtScope::RtScope() : active_(rt_enabled)
+{
+    if (active_)
+        rt_depth++;
+}
+
+RtScope::~RtScope()
+{
+    if (active_)
+        rt_depth--;
+}
+
+RtUnchecked::RtUnchecked()
+{
+    rt_quiet++;
+}
+
+RtUnchecked::~RtUnchecked()
+{
+    rt_quiet--;
+}
+
+__attribute__((noinline)) void rt_check_note(RtOperation operation, int skip)
+{
+    if (!rt_checking())
+        return;
+    rt_quiet++;
+
+    void *stack[kMaxFrames + 4];
+    int frames = backtrace(stack, kMaxFrames + 4);
+    skip = std::min(skip, frames);
+    frames = std::min(frames - skip, kMaxFrames);
+
+    uint64_t hash = 1469598103934665603ull ^ (uint64_t)operation; // FNV-1a over the addresses
+    for (int i = 0; i < frames; ++i)
+        hash = (hash ^ (uint64_t)(uintptr_t)stack[skip + i]) * 1099511628211ull;
+
+    for (int probe = 0; probe < kTableSize; ++probe)
+    {
+        t_record &r = rt_table[(hash + probe) % kTableSize];
+        if (r.count == 0)
+        {
+            if (rt_used >= kTableSize * 3 / 4)
+                break;
+            r.operation = operation;
+            r.hash = hash;
+            r.frames = frames;
+            memcpy(r.stack, stack + skip, frames * sizeof(void *));
+            r.count = 1;
+            rt_used++;
+            rt_quiet--;
+            return;
+        }
+        if (r.hash == hash && r.operation == operation && r.frames == frames &&
+            !memcmp(r.stack, stack + skip, frames * sizeof(void *)))
+        {
+            r.count++;
+            rt_quiet--;
+            return;
+        }
+    }
+    rt_dropped++;
+    rt_quiet--;
+}
+
+std::vector<RtViolation> rt_check_report()
+{
+    RtUnchecked unchecked;
+    std::map<std::pair<int, std::string>, RtViolation> sites;
+    for (const t_record &r : rt_table)
+    {
+        if (!r.count)
+            continue;
+        // the innermost external frame, and the stack up to where the
+        // external was entered
+        int site = -1, end = r.frames;
+        for (int i = 0; i < r.frames; ++i)
+        {
+            Dl_info info;
+            bool external = dladdr(r.stack[i], &info) && is_external(info);
+            if (external && site < 0)
+                site = i;
+            else if (!external && site >= 0)
+            {
+                end = i;
+                break;
+            }
+        }
+        site = std::max(site, 0);
+        std::string name = r.frames ? frame_name(r.stack[site]) : "?";
+        auto found = sites.find({r.operation, name});
+        if (found != sites.end())
+        {
+            found->second.count += r.count;
+            continue;
+        }
+        RtViolation v;
+        v.operation = r.operation;
+        v.site = name;
+        v.count = r.count;
+        for (int i = 0; i < end; ++i)
+            v.stack.push_back(frame_name(r.stack[i]));
+        sites.emplace(std::make_pair((int)r.operation, name), v);
+    }
+
+    std::vector<RtViolation> violations;
+    for (auto &site : sites)
+        violations.push_back(site.second);
+    std::stable_sort(violations.begin(), violations.end(),
+                     [](const RtViolation &a, const RtViolation &b) { return a.count > b.count; });
+    return violations;
+}
+
+long rt_check_dropped()
+{
+    return rt_dropped;
+}
+
+void rt_check_reset()
+{
+    for (t_record &r : rt_table)
+        r.count = 0;
+    rt_used = 0;
+    rt_dropped = 0;
+}
+
+void rt_check_print(FILE *f, const std::vector<RtViolation> &violations, int max_frames)
+{
+    for (const RtViolation &v : violations)
+    {
+        fprintf(f, "  %-9s x%-6ld %s\n", rt_operation_name(v.operation), v.count, v.site.c_str());
+        for (int i = 0; i < (int)v.stack.size() && i < max_frames; ++i)
+            fprintf(f, "      %s\n", v.stack[i].c_str());
+    }
+    if (rt_dropped)
+        fprintf(f, "  (%ld more, table full)\n", rt_dropped);
+}
+
+} // namespace pdmi
+
+#pragma mark----- hooks -----
+
+#ifdef RT_CHECK_HOOKS
+
+// glibc allows replacing malloc, free, calloc and realloc (and picks up the
+// aligned variants too); the replacements forward to its own allocator.
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void __libc_free(void *ptr);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+    void *__libc_memalign(size_t alignment, size_t size);
+
+    void *malloc(size_t size)
+    {
+        if (rt_checking())
+            rt_check_note(RT_MALLOC);
+        return __libc_malloc(size);
+    }
+
+    void free(void *ptr)
+    {
+        if (ptr && rt_checking())
+            rt_check_note(RT_FREE);
+        __libc_free(ptr);
+    }
+
+    void *calloc(size_t count, size_t size)
+    {
+        if (rt_checking())
+            rt_check_note(RT_MALLOC);
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *ptr, size_t size)
+    {
+        if (rt_checking())
+            rt_check_note(RT_MALLOC);
+        return __libc_realloc(ptr, size);
+    }
+
+    void *memalign(size_t alignment, size_t size)
+    {
+        if (rt_checking())
+            rt_check_note(RT_MALLOC);
+        return __libc_memalign(alignment, size);
+    }
+
+    void *aligned_alloc(size_t alignment, size_t size)
+    {
+        if (rt_checking())
+            rt_check_note(RT_MALLOC);
+        return __libc_memalign(alignment, size);
+    }
+
+    int posix_memalign(void **out, size_t alignment, size_t size)
+    {
+        if (alignment < sizeof(void *) || (alignment & (alignment - 1)))
+            return EINVAL;
+        if (rt_checking())
+            rt_check_note(RT_MALLOC);
+        void *ptr = __libc_memalign(alignment, size);
+        if (!ptr)
+            return ENOMEM;
+        *out = ptr;
+        return 0;
+    }
+
+    // uncontended locks are cheap, but a perform routine can't know that
+    int pthread_mutex_lock(pthread_mutex_t *mutex)
+    {
+        typedef int (*t_lock)(pthread_mutex_t *);
+        static t_lock next = nullptr;
+        if (!next)
+            next = (t_lock)dlsym(RTLD_NEXT, "pthread_mutex_lock");
+        if (rt_checking())
+            rt_check_note(RT_LOCK);
+        return next(mutex);
+    }
+}
+
+#endif // RT_CHECK_HOOKS
@@ -0,0 +1,95 @@
+//
+//  rt_check.h
+//  pd-mi
+//
+
+// Real-time safety checks for the perform routines.
+//
+// Once enabled, the calls that can block or take unbounded time are
+// recorded with their call stack while DspChain::Tick() runs the perform
+// routines: heap allocation (malloc, calloc, realloc, free and the aligned
+// variants, so operator new and delete as well), mutex locks, getbytes /
+// resizebytes / freebytes and console output (post, logpost, verbose,
+// pd_error). Message handlers and dsp methods are not checked.
+//
+// malloc and pthread_mutex_lock are replaced in the harness executables,
+// which export them to the externals; that needs glibc. Elsewhere only the
+// Pd API calls are seen.
+//
+// Violations are grouped by operation and call site, the first frame in an
+// external, given as symbol+offset and module offset for addr2line.
+
+#ifndef PD_MI_HARNESS_RT_CHECK_H_
+#define PD_MI_HARNESS_RT_CHECK_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace pdmi
+{
+
+enum RtOperation
+{
+    RT_MALLOC,
+    RT_FREE,
+    RT_LOCK,
+    RT_GETBYTES,
+    RT_FREEBYTES,
+    RT_POST,
+    RT_LAST
+};
+
+const char *rt_operation_name(RtOperation operation);
+
+void rt_check_enable(bool on);
+bool rt_check_enabled();
+
+// true if malloc and locks are seen, not just the Pd API
+bool rt_check_hooks_installed();
+
+// Marks the perform routines: calls between construction and destruction
+// are checked. Nests, costs a branch while checking is off.
+class RtScope
+{
+public:
+    RtScope();
+    ~RtScope();
+
+private:
+    bool active_;
+};
+
+// Suspends checking, for the host's own work behind a call that has been
+// recorded already (getbytes -> calloc, post -> stdio).
+class RtUnchecked
+{
+public:
+    RtUnchecked();
+    ~RtUnchecked();
+};
+
+// records operation if inside an RtScope; skip drops the innermost frames
+// (the checker and the function that calls this)
+void rt_check_note(RtOperation operation, int skip = 2);
+
+struct RtViolation
+{
+    RtOperation operation;
+    std::string site;
+    std::vector<std::string> stack; // of the first occurrence
+    long count;
+};
+
+// since the last reset, most frequent first
+std::vector<RtViolation> rt_check_report();
+// violations that didn't fit the table since the last reset
+long rt_check_dropped();
+void rt_check_reset();
+
+// prints up to max_frames of each stack
+void rt_check_print(FILE *f, const std::vector<RtViolation> &violations, int max_frames = 6);
+
+} // namespace pdmi
+
+#endif // PD_MI_HARNESS_RT_CHECK_H_
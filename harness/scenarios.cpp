@@ -0,0 +1,213 @@
+//
+//  scenarios.cpp
+//  pd-mi
+//
+
+#include "scenarios.h"
+
+#include <algorithm>
+
+// inputs loop every 2 s or so, a whole number of the largest block size
+static const size_t kInputLength = 48 * 2048;
+
+namespace pdmi
+{
+
+static void add_plts(std::vector<Scenario> &scenarios)
+{
+    // engine, note, frequency, harmonics, timbre, morph, trigger, level
+    std::vector<Source> inputs = {
+        constant(0.f), sine(0.1f, 7.f), constant(0.f), constant(0.f),
+        sine(0.3f, 0.5f), constant(0.f), pulse(4.f), constant(0.f),
+    };
+    for (int engine = 0; engine < 16; ++engine)
+    {
+        scenarios.push_back({"pd.mi.plts~", "engine " + std::to_string(engine), "",
+                             {"note 48", "harmonics 0.5", "timbre 0.5", "morph 0.5", "decay 0.5",
+                              "timbre_mod 0.3", "plug timbre 1", "plug trigger 1",
+                              "engine " + std::to_string(engine)},
+                             inputs, 1});
+    }
+}
+
+static void add_plts_pool(std::vector<Scenario> &scenarios)
+{
+    // the same voices on the audio thread and on workers, which have to
+    // render the same output
+    std::vector<std::string> notes = {"harmonics 0.5", "timbre 0.5", "morph 0.5", "decay 0.8"};
+    for (int voice = 0; voice < 16; ++voice)
+        notes.push_back("voice " + std::to_string(voice) + " " + std::to_string(36 + 3 * voice) + " 0.2");
+    for (int threads : {0, 3})
+    {
+        std::string args = "16 @threads " + std::to_string(threads) + " @pin 0";
+        std::string name = "16 voices threads " + std::to_string(threads);
+        scenarios.push_back({"pd.mi.plts_pool~", name, args, notes, {}, 1});
+        scenarios.push_back({"pd.mi.plts_pool~", name + " drone", args + " @drone 1 @engine 8", notes, {}, 1});
+    }
+}
+
+static void add_tds(std::vector<Scenario> &scenarios)
+{
+    static const char *output_modes[] = {"gates", "amplitude", "phase", "frequency"};
+    static const char *ramp_modes[] = {"ad", "looping", "ar"};
+
+    // frequency (Hz), shape, slope, smooth, shift, trigger, clock
+    std::vector<Source> audio = {
+        sine(5.f, 2.f, 110.f), sine(0.1f, 0.25f, 0.5f), sine(0.13f, 0.25f, 0.5f),
+        sine(0.17f, 0.25f, 0.5f), sine(0.2f, 0.25f, 0.5f), pulse(2.f), constant(0.f),
+    };
+    for (int output_mode = 0; output_mode < 4; ++output_mode)
+    {
+        for (int ramp_mode = 0; ramp_mode < 3; ++ramp_mode)
+        {
+            scenarios.push_back({"pd.mi.tds~",
+                                 std::string(output_modes[output_mode]) + " " + ramp_modes[ramp_mode], "",
+                                 {"range 1", "plug trig 1",
+                                  "output_mode " + std::to_string(output_mode),
+                                  "ramp_mode " + std::to_string(ramp_mode)},
+                                 audio, 1});
+        }
+    }
+
+    std::vector<Source> clocked = audio;
+    clocked[0] = constant(1.f);
+    clocked[6] = pulse(2.f);
+    scenarios.push_back({"pd.mi.tds~", "clocked", "",
+                         {"range 0", "plug clock 1", "output_mode 1", "ramp_mode 1"},
+                         clocked, 1});
+
+    // 750 Hz, a period per envelope window, so the cached loop has to match
+    // the live one whatever the phase it starts from
+    std::vector<Source> steady = audio;
+    for (int i = 0; i < 5; ++i)
+        steady[i] = constant(i == 0 ? 750.f : 0.5f);
+    scenarios.push_back({"pd.mi.tds~", "steady", "",
+                         {"range 1", "freq 0", "output_mode 1", "ramp_mode 1"},
+                         steady, 1});
+    scenarios.push_back({"pd.mi.tds~", "cycle cache", "",
+                         {"range 1", "freq 0", "cycle_cache 1", "output_mode 1", "ramp_mode 1"},
+                         steady, 1, "steady", 1e-3});
+}
+
+static void add_warps(std::vector<Scenario> &scenarios, const char *external, int algorithms, bool multichannel)
+{
+    // carrier, modulator, level 1, level 2, algo, timbre (CVs)
+    std::vector<Source> inputs = {
+        saw(110.f, 0.8f), sine(220.f, 0.6f), constant(0.f), constant(0.f),
+        constant(0.f), sine(0.2f, 0.1f),
+    };
+    for (int oversample = 0; oversample < 2; ++oversample)
+    {
+        for (int algo = 0; algo < algorithms; ++algo)
+        {
+            // the FFT vocoder doesn't oversample
+            if (oversample && algo > 8)
+                continue;
+            std::string name = "algo " + std::to_string(algo) + (oversample ? " oversampled" : "");
+            scenarios.push_back({external, name, "",
+                                 {"level1 0.8", "level2 0.8", "timbre 0.5",
+                                  "oversample " + std::to_string(oversample),
+                                  "algo " + std::to_string(algo)},
+                                 inputs, 1});
+        }
+    }
+    if (multichannel)
+    {
+        scenarios.push_back({external, "algo 4 channels 4", "",
+                             {"level1 0.8", "level2 0.8", "timbre 0.5", "algo 4", "channels 4"},
+                             inputs, 4});
+    }
+}
+
+static void add_vocoder_bus(std::vector<Scenario> &scenarios)
+{
+    // a subscriber alone on a vocoder bus runs the split vocoder on its own
+    // modulator, and has to sound like warps' vocoder in a plain wrps~
+    std::vector<Source> inputs = {
+        saw(110.f, 0.8f), noise(0.6f), constant(0.f), constant(0.f),
+        constant(0.f), constant(0.f),
+    };
+    std::vector<std::string> messages = {"level1 0.8", "level2 0.8", "timbre 0.5", "osc_shape 0", "algo 8"};
+    scenarios.push_back({"pd.mi.wrps~", "vocoder", "", messages, inputs, 1});
+    scenarios.push_back({"pd.mi.wrps~", "vocoder bus", "@vocoder_bus golden", messages, inputs, 1,
+                         "vocoder", 0.01});
+}
+
+std::vector<std::string> all_externals()
+{
+    return {"pd.mi.plts~", "pd.mi.tds~", "pd.mi.wrps~", "pd.mi.wraps~", "pd.mi.plts_pool~"};
+}
+
+std::vector<Scenario> all_scenarios()
+{
+    std::vector<Scenario> scenarios;
+    add_plts(scenarios);
+    add_tds(scenarios);
+    add_warps(scenarios, "pd.mi.wrps~", 10, true);
+    add_vocoder_bus(scenarios);
+    add_warps(scenarios, "pd.mi.wraps~", 9, false);
+    add_plts_pool(scenarios);
+    return scenarios;
+}
+
+ScenarioRunner::ScenarioRunner(const Scenario &scenario, int block_size)
+    : chain_(block_size), object_(nullptr), ok_(false), channels_(scenario.channels), position_(0)
+{
+    object_ = host_new(scenario.external, host_parse(scenario.args));
+    if (!object_)
+    {
+        error_ = "can't create " + scenario.external;
+        return;
+    }
+    for (const std::string &message : scenario.messages)
+    {
+        if (!host_send(object_, message))
+        {
+            error_ = scenario.external + ": no method for '" + message + "'";
+            return;
+        }
+    }
+    if ((int)scenario.inputs.size() != host_signal_inlets(object_))
+    {
+        error_ = scenario.id() + ": " + std::to_string(scenario.inputs.size()) + " sources for " +
+                 std::to_string(host_signal_inlets(object_)) + " signal inlets";
+        return;
+    }
+
+    inputs_.resize(scenario.inputs.size());
+    for (size_t i = 0; i < inputs_.size(); ++i)
+    {
+        inputs_[i].resize(kInputLength);
+        Render(scenario.inputs[i], host_samplerate(), (uint32_t)i, inputs_[i].data(), kInputLength);
+    }
+
+    chain_.Add(object_, channels_);
+    chain_.Start();
+    ok_ = true;
+}
+
+ScenarioRunner::~ScenarioRunner()
+{
+    host_free(object_);
+}
+
+void ScenarioRunner::Tick()
+{
+    size_t n = chain_.block_size();
+    for (size_t i = 0; i < inputs_.size(); ++i)
+    {
+        t_sample *in = chain_.input(0, (int)i);
+        for (size_t done = 0; done < n;)
+        {
+            size_t position = (position_ + done) % kInputLength;
+            size_t chunk = std::min(n - done, kInputLength - position);
+            for (int c = 0; c < channels_; ++c)
+                std::copy(&inputs_[i][position], &inputs_[i][position] + chunk, in + c * n + done);
+            done += chunk;
+        }
+    }
+    position_ = (position_ + n) % kInputLength;
+    chain_.Tick();
+}
+
+} // namespace pdmi
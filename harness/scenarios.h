@@ -0,0 +1,77 @@
+//
+//  scenarios.h
+//  pd-mi
+//
+
+// The configurations the harness runs each external in: creation arguments,
+// the messages sent before DSP starts, and a signal for every signal inlet.
+// Together they cover every plaits engine, the tides output and ramp modes,
+// the warps algorithms, with and without oversampling, wrps~'s vocoder bus,
+// and the plaits voice pool with and without worker threads.
+
+#ifndef PD_MI_HARNESS_SCENARIOS_H_
+#define PD_MI_HARNESS_SCENARIOS_H_
+
+#include "pd_host.h"
+#include "signals.h"
+
+#include <string>
+#include <vector>
+
+namespace pdmi
+{
+
+struct Scenario
+{
+    std::string external; // "pd.mi.plts~"
+    std::string name;     // "engine 3", unique per external
+    std::string args;     // creation arguments
+    std::vector<std::string> messages;
+    std::vector<Source> inputs; // one per signal inlet
+    int channels;               // input channels, > 1 for multichannel objects
+
+    // set for a scenario that has to render like another one of the same
+    // external, within match_tolerance on every envelope window, instead of
+    // like a reference file
+    std::string matches;
+    double match_tolerance = 0.0;
+
+    std::string id() const { return external + " " + name; }
+};
+
+// the externals the scenarios are written for
+std::vector<std::string> all_externals();
+std::vector<Scenario> all_scenarios();
+
+// One scenario at one block size: creates the object, sends the messages
+// and feeds the inlets from the sources, which are rendered once and then
+// looped. The external has to be loaded already.
+class ScenarioRunner
+{
+public:
+    ScenarioRunner(const Scenario &scenario, int block_size);
+    ~ScenarioRunner();
+
+    // false if the object couldn't be created or doesn't take a message
+    bool ok() const { return ok_; }
+    const std::string &error() const { return error_; }
+
+    // fills the inlets with the next block and runs the chain
+    void Tick();
+
+    t_object *object() { return object_; }
+    DspChain &chain() { return chain_; }
+
+private:
+    DspChain chain_;
+    t_object *object_;
+    bool ok_;
+    std::string error_;
+    int channels_;
+    std::vector<std::vector<t_sample>> inputs_;
+    size_t position_;
+};
+
+} // namespace pdmi
+
+#endif // PD_MI_HARNESS_SCENARIOS_H_
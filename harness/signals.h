@@ -0,0 +1,82 @@
+//
+//  signals.h
+//  pd-mi
+//
+
+// Deterministic inlet signals for the harness: constants, sines, bipolar
+// ramps, pulse trains and noise. They are rendered into a buffer up front,
+// so generating them doesn't show up in the measurements, and the noise is
+// seeded, so two runs feed an external exactly the same input.
+
+#ifndef PD_MI_HARNESS_SIGNALS_H_
+#define PD_MI_HARNESS_SIGNALS_H_
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace pdmi
+{
+
+struct Source
+{
+    enum Kind
+    {
+        CONSTANT,
+        SINE,
+        SAW,
+        PULSE,
+        NOISE
+    };
+    Kind kind;
+    float frequency;
+    float amplitude;
+    float offset;
+};
+
+inline Source constant(float value) { return {Source::CONSTANT, 0.f, 0.f, value}; }
+inline Source sine(float frequency, float amplitude, float offset = 0.f) { return {Source::SINE, frequency, amplitude, offset}; }
+inline Source saw(float frequency, float amplitude, float offset = 0.f) { return {Source::SAW, frequency, amplitude, offset}; }
+// 5 ms high, like a gate from a sequencer
+inline Source pulse(float frequency, float amplitude = 1.f) { return {Source::PULSE, frequency, amplitude, 0.f}; }
+inline Source noise(float amplitude) { return {Source::NOISE, 0.f, amplitude, 0.f}; }
+
+inline void Render(const Source &source, float sample_rate, uint32_t seed, float *out, size_t size)
+{
+    double increment = source.frequency / sample_rate;
+    double width = 0.005 * source.frequency;
+    double phase = 0.0;
+    uint32_t state = seed * 2654435761u + 1u;
+    for (size_t i = 0; i < size; ++i)
+    {
+        float value = 0.f;
+        switch (source.kind)
+        {
+        case Source::CONSTANT:
+            break;
+        case Source::SINE:
+            value = static_cast<float>(sin(2.0 * M_PI * phase));
+            break;
+        case Source::SAW:
+            value = static_cast<float>(2.0 * phase - 1.0);
+            break;
+        case Source::PULSE:
+            value = phase < width ? 1.f : 0.f;
+            break;
+        case Source::NOISE:
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            value = static_cast<float>(state) / 2147483648.f - 1.f;
+            break;
+        }
+        out[i] = source.offset + source.amplitude * value;
+        phase += increment;
+        if (phase >= 1.0)
+            phase -= 1.0;
+    }
+}
+
+} // namespace pdmi
+
+#endif // PD_MI_HARNESS_SIGNALS_H_
@@ -0,0 +1,213 @@
+//
+//  soak.cpp
+//  pd-mi
+//
+
+// pd-mi-soak: checks that the perform routines don't get slower when their
+// input goes silent, which is what denormals do to decaying filters, delays
+// and envelopes, and that the output stays finite.
+//
+// Each scenario is run at one block size: --excite seconds with the
+// scenario's inputs, then --silence seconds with every inlet at zero. The
+// cost is the median ns per block over windows of --window seconds. A run
+// fails if a silent window is more than --threshold times the excited one,
+// or if an output sample is NaN or Inf.
+//
+//   pd-mi-soak [--externals DIR] [--filter TEXT] [--block N] [--excite S]
+//              [--silence S] [--window S] [--threshold X] [-v]
+
+#include "pd_host.h"
+#include "scenarios.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#ifndef PD_MI_EXTERNALS_DIR
+#define PD_MI_EXTERNALS_DIR "externals"
+#endif
+
+using namespace pdmi;
+
+// as the golden test, for ctest's SKIP_RETURN_CODE
+const int kSkipped = 77;
+const float kSampleRate = 48000.f;
+
+struct t_options
+{
+    std::string externals = PD_MI_EXTERNALS_DIR;
+    std::string filter;
+    int block = 64;
+    double excite = 1.0;
+    double silence = 20.0;
+    double window = 1.0;
+    double threshold = 2.0;
+    int verbosity = 1;
+};
+
+static void usage()
+{
+    fprintf(stderr, "usage: pd-mi-soak [--externals DIR] [--filter TEXT] [--block N] [--excite S]\n"
+                    "                  [--silence S] [--window S] [--threshold X] [-v]\n");
+}
+
+static bool parse_options(int argc, char **argv, t_options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-v")
+            options.verbosity = 4;
+        else if (arg == "--externals" && has_value)
+            options.externals = argv[++i];
+        else if (arg == "--filter" && has_value)
+            options.filter = argv[++i];
+        else if (arg == "--block" && has_value)
+            options.block = atoi(argv[++i]);
+        else if (arg == "--excite" && has_value)
+            options.excite = atof(argv[++i]);
+        else if (arg == "--silence" && has_value)
+            options.silence = atof(argv[++i]);
+        else if (arg == "--window" && has_value)
+            options.window = atof(argv[++i]);
+        else if (arg == "--threshold" && has_value)
+            options.threshold = atof(argv[++i]);
+        else
+            return false;
+    }
+    return options.block > 0 && options.excite > 0 && options.silence >= options.window &&
+           options.window > 0 && options.threshold > 1.0;
+}
+
+static double median(std::vector<double> &values)
+{
+    std::sort(values.begin(), values.end());
+    return values.empty() ? 0.0 : values[values.size() / 2];
+}
+
+static bool outputs_finite(ScenarioRunner &runner)
+{
+    int outlets = host_signal_outlets(runner.object());
+    for (int outlet = 0; outlet < outlets; ++outlet)
+    {
+        int channels = 1;
+        const t_sample *out = runner.chain().output(0, outlet, &channels);
+        for (int i = 0; i < channels * runner.chain().block_size(); ++i)
+            if (!std::isfinite(out[i]))
+                return false;
+    }
+    return true;
+}
+
+// median ns per block over blocks calls of tick, which fills the inlets and
+// runs the chain; clears finite on NaN or Inf
+template <typename F>
+static double run_window(ScenarioRunner &runner, long blocks, bool &finite, F &&tick)
+{
+    std::vector<double> ns(blocks);
+    for (long b = 0; b < blocks; ++b)
+    {
+        auto start = std::chrono::steady_clock::now();
+        tick();
+        auto end = std::chrono::steady_clock::now();
+        ns[b] = std::chrono::duration<double, std::nano>(end - start).count();
+        finite = finite && outputs_finite(runner);
+    }
+    return median(ns);
+}
+
+static bool soak(const Scenario &scenario, const t_options &options)
+{
+    ScenarioRunner runner(scenario, options.block);
+    if (!runner.ok())
+    {
+        printf("ERROR    %s: %s\n", scenario.id().c_str(), runner.error().c_str());
+        return false;
+    }
+
+    long window_blocks = std::max(1L, (long)(options.window * kSampleRate / options.block));
+    long excite_windows = std::max(1L, (long)(options.excite / options.window + 0.5));
+    long silent_windows = (long)(options.silence / options.window);
+    int inlets = host_signal_inlets(runner.object());
+    size_t inlet_size = (size_t)scenario.channels * options.block;
+
+    bool finite = true;
+    double reference = 0.0;
+    for (long w = 0; w < excite_windows; ++w)
+    {
+        double ns = run_window(runner, window_blocks, finite, [&]() { runner.Tick(); });
+        reference = w == 0 ? ns : std::min(reference, ns);
+    }
+
+    auto silent_tick = [&]() {
+        for (int i = 0; i < inlets; ++i)
+            std::fill(runner.chain().input(0, i), runner.chain().input(0, i) + inlet_size, 0.0f);
+        runner.chain().Tick();
+    };
+    double worst = 0.0;
+    long worst_window = 0;
+    for (long w = 0; w < silent_windows; ++w)
+    {
+        double ns = run_window(runner, window_blocks, finite, silent_tick);
+        if (options.verbosity > 1)
+            printf("         %s: silent window %ld %.0f ns/block\n", scenario.id().c_str(), w, ns);
+        if (ns > worst)
+        {
+            worst = ns;
+            worst_window = w;
+        }
+    }
+
+    double ratio = reference > 0 ? worst / reference : 0.0;
+    bool flat = ratio <= options.threshold;
+    const char *status = !finite ? "NAN" : (flat ? "OK" : "SPIKE");
+    printf("%-8s %s: %.0f ns/block excited, %.0f silent (window %ld), x%.2f\n", status, scenario.id().c_str(),
+           reference, worst, worst_window, ratio);
+    return finite && flat;
+}
+
+int main(int argc, char **argv)
+{
+    t_options options;
+    if (!parse_options(argc, argv, options))
+    {
+        usage();
+        return 2;
+    }
+    host_set_samplerate(kSampleRate);
+    host_set_verbosity(options.verbosity);
+
+    std::vector<std::string> loaded;
+    for (const std::string &name : all_externals())
+    {
+        std::string error;
+        if (host_load(options.externals, name, error))
+            loaded.push_back(name);
+        else
+            fprintf(stderr, "%s\n", error.c_str());
+    }
+    if (loaded.empty())
+    {
+        fprintf(stderr, "no externals in %s, skipping\n", options.externals.c_str());
+        return kSkipped;
+    }
+
+    int passed = 0, total = 0;
+    for (const Scenario &scenario : all_scenarios())
+    {
+        if (std::find(loaded.begin(), loaded.end(), scenario.external) == loaded.end())
+            continue;
+        if (!options.filter.empty() && scenario.id().find(options.filter) == std::string::npos)
+            continue;
+        fflush(stdout);
+        total++;
+        passed += soak(scenario, options) ? 1 : 0;
+    }
+    printf("%d ok, %d failed\n", passed, total - passed);
+    return passed == total ? 0 : 1;
+}
@@ -0,0 +1,118 @@
+//
+//  block_adapter.h
+//  pd-mi
+//
+
+// FIFO adapter between the Pd vector size and the fixed block size of a
+// DSP engine.
+//
+// If the vector size is a multiple of the engine block size, blocks are
+// rendered straight from and into the Pd signal vectors, with no added
+// latency. Otherwise samples go through an internal FIFO and come out
+// exactly kBlockSize samples late, whatever the vector size (block~ 1 works).
+//
+// The object is plain data, so it can live in a pd_new()'ed struct: call
+// Init() once and Configure() from the dsp method.
+
+#ifndef PD_MI_BLOCK_ADAPTER_H_
+#define PD_MI_BLOCK_ADAPTER_H_
+
+#include <m_pd.h>
+
+#include <cstddef>
+
+namespace pdmi
+{
+
+template <size_t kNumInputs, size_t kNumOutputs, size_t kBlockSize>
+class BlockAdapter
+{
+public:
+    void Init()
+    {
+        direct_ = true;
+        Reset();
+    }
+
+    void Reset()
+    {
+        position_ = 0;
+        for (size_t c = 0; c < kNumInputs; ++c)
+            for (size_t i = 0; i < kBlockSize; ++i)
+                in_[c][i] = 0;
+        for (size_t c = 0; c < kNumOutputs; ++c)
+            for (size_t i = 0; i < kBlockSize; ++i)
+                out_[c][i] = 0;
+    }
+
+    // call from the dsp method with the vector size of the signal chain
+    void Configure(int vs)
+    {
+        direct_ = vs >= static_cast<int>(kBlockSize) && vs % kBlockSize == 0;
+        Reset();
+    }
+
+    size_t latency() const
+    {
+        return direct_ ? 0 : kBlockSize;
+    }
+
+    bool direct() const
+    {
+        return direct_;
+    }
+
+    // render(ins, outs, offset) processes exactly kBlockSize samples; offset
+    // is the position of the block within the Pd vector (always 0 in FIFO
+    // mode). Each block's inputs have to be read before its outputs are
+    // written, as Pd may hand out the same vector for an inlet and an outlet.
+    template <typename Render>
+    void Process(t_sample *const *ins, t_sample *const *outs, int vs, Render &&render)
+    {
+        if (direct_)
+        {
+            t_sample *block_in[kNumInputs];
+            t_sample *block_out[kNumOutputs];
+            for (int count = 0; count < vs; count += kBlockSize)
+            {
+                for (size_t c = 0; c < kNumInputs; ++c)
+                    block_in[c] = ins[c] + count;
+                for (size_t c = 0; c < kNumOutputs; ++c)
+                    block_out[c] = outs[c] + count;
+                render(block_in, block_out, count);
+            }
+            return;
+        }
+
+        t_sample *fifo_in[kNumInputs];
+        t_sample *fifo_out[kNumOutputs];
+        for (size_t c = 0; c < kNumInputs; ++c)
+            fifo_in[c] = in_[c];
+        for (size_t c = 0; c < kNumOutputs; ++c)
+            fifo_out[c] = out_[c];
+
+        for (int i = 0; i < vs; ++i)
+        {
+            for (size_t c = 0; c < kNumInputs; ++c)
+                in_[c][position_] = ins[c][i];
+            for (size_t c = 0; c < kNumOutputs; ++c)
+                outs[c][i] = out_[c][position_];
+
+            if (++position_ >= kBlockSize)
+            {
+                render(fifo_in, fifo_out, 0);
+                position_ = 0;
+            }
+        }
+    }
+
+private:
+    t_sample in_[kNumInputs][kBlockSize];
+    t_sample out_[kNumOutputs][kBlockSize];
+    size_t position_;
+    bool direct_;
+};
+
+} // namespace pdmi
+
+#endif // PD_MI_BLOCK_ADAPTER_H_
@@ -0,0 +1,82 @@
+//
+//  denormals.h
+//  pd-mi
+//
+
+// Denormal and NaN guards for the perform routines.
+//
+// Decaying filters, envelopes and reverb tails end up in denormal range
+// when a voice goes quiet, and on x86 every operation on a denormal costs
+// around a hundred cycles. ScopedFlushDenormals sets flush-to-zero and
+// denormals-are-zero (the FZ bit on arm64) for one perform call and puts
+// the caller's mode back afterwards, as Pd doesn't set it. Elsewhere it
+// does nothing.
+//
+// is_finite() is the check for NaN/Inf in a rendered block: any of them
+// turns the sum of x * 0 into NaN. The externals reinitialise the DSP
+// object that produced it and output silence for that block.
+
+#ifndef PD_MI_DENORMALS_H_
+#define PD_MI_DENORMALS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define PD_MI_DENORMALS_SSE 1
+#endif
+
+namespace pdmi
+{
+
+class ScopedFlushDenormals
+{
+public:
+    ScopedFlushDenormals()
+    {
+#if defined(PD_MI_DENORMALS_SSE)
+        saved_ = _mm_getcsr();
+        _mm_setcsr(saved_ | kFlushMask);
+#elif defined(__aarch64__)
+        uint64_t fpcr;
+        asm volatile("mrs %0, fpcr" : "=r"(fpcr));
+        saved_ = fpcr;
+        asm volatile("msr fpcr, %0" : : "r"(fpcr | kFlushMask));
+#endif
+    }
+
+    ~ScopedFlushDenormals()
+    {
+#if defined(PD_MI_DENORMALS_SSE)
+        _mm_setcsr(saved_);
+#elif defined(__aarch64__)
+        asm volatile("msr fpcr, %0" : : "r"(saved_));
+#endif
+    }
+
+    ScopedFlushDenormals(const ScopedFlushDenormals &) = delete;
+    ScopedFlushDenormals &operator=(const ScopedFlushDenormals &) = delete;
+
+private:
+#if defined(PD_MI_DENORMALS_SSE)
+    static const unsigned int kFlushMask = 0x8040; // FTZ | DAZ
+    unsigned int saved_;
+#elif defined(__aarch64__)
+    static const uint64_t kFlushMask = uint64_t(1) << 24; // FZ
+    uint64_t saved_;
+#endif
+};
+
+template <typename T>
+inline bool is_finite(const T *x, size_t size)
+{
+    T sum = 0;
+    for (size_t i = 0; i < size; ++i)
+        sum += x[i] * T(0);
+    return sum == T(0);
+}
+
+} // namespace pdmi
+
+#endif // PD_MI_DENORMALS_H_
@@ -0,0 +1,191 @@
+//
+//  fft_vocoder.h
+//  pd-mi
+//
+
+// Channel vocoder on short-time spectra, for band counts a filter bank
+// can't afford.
+//
+// Modulator and carrier are cut into frames of size samples (sqrt-Hann
+// windowed, hop size / 2) and transformed with RealFft. The bins are grouped
+// into 32..128 log-spaced bands; per band the modulator energy is followed
+// with an attack/release envelope, and the carrier bins of that band are
+// scaled by sqrt(modulator / carrier energy), i.e. the carrier spectrum is
+// flattened and takes the modulator's envelope. The result is transformed
+// back and overlap-added, with a latency of size samples.
+//
+// The cost per sample is three real FFTs per hop, independent of the band
+// count. All storage is inline, Init does not allocate.
+
+#ifndef PD_MI_FFT_VOCODER_H_
+#define PD_MI_FFT_VOCODER_H_
+
+#include "real_fft.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+namespace pdmi
+{
+
+const size_t kFftVocoderMinSize = 256;
+const size_t kFftVocoderMaxSize = 2048;
+const int kFftVocoderMinBands = 32;
+const int kFftVocoderMaxBands = 128;
+
+class FftVocoder
+{
+public:
+    // size: power of two in kFftVocoderMinSize..kFftVocoderMaxSize
+    void Init(float sample_rate, size_t size, int num_bands)
+    {
+        sample_rate_ = sample_rate;
+        size_ = size;
+        hop_ = size / 2;
+        fft_.Init(size);
+
+        for (size_t i = 0; i < size; ++i)
+            window_[i] = static_cast<float>(sqrt(0.5 - 0.5 * cos(2.0 * M_PI * i / size)));
+
+        // log-spaced band edges from 60 Hz to 0.9 * nyquist, at least one
+        // bin wide, so small frames can end up with fewer bands
+        size_t bins = hop_ + 1;
+        float bin_hz = sample_rate / size;
+        float lo = 60.0f, hi = 0.45f * sample_rate;
+        size_t edge = 1;
+        num_bands_ = 0;
+        band_start_[0] = 1;
+        for (int band = 1; band <= num_bands && edge < bins; ++band)
+        {
+            float f = lo * powf(hi / lo, static_cast<float>(band) / num_bands);
+            size_t next = static_cast<size_t>(f / bin_hz + 0.5f);
+            if (next <= edge)
+                next = edge + 1;
+            if (band == num_bands || next > bins)
+                next = bins;
+            band_start_[++num_bands_] = next;
+            edge = next;
+        }
+
+        Reset();
+        set_release(0.5f);
+    }
+
+    void Reset()
+    {
+        std::memset(modulator_frame_, 0, sizeof(modulator_frame_));
+        std::memset(carrier_frame_, 0, sizeof(carrier_frame_));
+        std::memset(accumulator_, 0, sizeof(accumulator_));
+        std::memset(ready_, 0, sizeof(ready_));
+        std::memset(envelope_, 0, sizeof(envelope_));
+        fill_ = 0;
+    }
+
+    // 0..1 maps to 10 ms..1 s
+    void set_release(float release)
+    {
+        float frame_time = static_cast<float>(hop_) / sample_rate_;
+        attack_ = 1.0f - expf(-frame_time / 0.005f);
+        release_ = 1.0f - expf(-frame_time / (0.01f * exp2f(release * 6.64386f)));
+    }
+
+    size_t latency() const { return size_; }
+    int num_bands() const { return num_bands_; }
+
+    void Process(const float *modulator, const float *carrier, float *out, size_t size)
+    {
+        size_t start = size_ - hop_;
+        for (size_t i = 0; i < size; ++i)
+        {
+            modulator_frame_[start + fill_] = modulator[i];
+            carrier_frame_[start + fill_] = carrier[i];
+            out[i] = ready_[fill_];
+            if (++fill_ == hop_)
+            {
+                ProcessFrame();
+                fill_ = 0;
+            }
+        }
+    }
+
+private:
+    void ProcessFrame()
+    {
+        float *scratch = output_frame_;
+        for (size_t i = 0; i < size_; ++i)
+            scratch[i] = modulator_frame_[i] * window_[i];
+        fft_.Forward(scratch, modulator_re_, modulator_im_);
+        for (size_t i = 0; i < size_; ++i)
+            scratch[i] = carrier_frame_[i] * window_[i];
+        fft_.Forward(scratch, carrier_re_, carrier_im_);
+
+        carrier_re_[0] = carrier_im_[0] = 0.f; // no DC
+        for (int band = 0; band < num_bands_; ++band)
+        {
+            float modulator_energy = 0.f, carrier_energy = 0.f;
+            for (size_t k = band_start_[band]; k < band_start_[band + 1]; ++k)
+            {
+                modulator_energy += modulator_re_[k] * modulator_re_[k] + modulator_im_[k] * modulator_im_[k];
+                carrier_energy += carrier_re_[k] * carrier_re_[k] + carrier_im_[k] * carrier_im_[k];
+            }
+            float &envelope = envelope_[band];
+            envelope += (modulator_energy > envelope ? attack_ : release_) * (modulator_energy - envelope);
+
+            float gain = sqrtf(envelope / (carrier_energy + 1e-6f));
+            gain = gain < kMaxGain ? gain : kMaxGain;
+            for (size_t k = band_start_[band]; k < band_start_[band + 1]; ++k)
+            {
+                carrier_re_[k] *= gain;
+                carrier_im_[k] *= gain;
+            }
+        }
+        for (size_t k = band_start_[num_bands_]; k <= hop_; ++k)
+            carrier_re_[k] = carrier_im_[k] = 0.f;
+
+        fft_.Inverse(carrier_re_, carrier_im_, output_frame_);
+
+        for (size_t i = 0; i < size_; ++i)
+            accumulator_[i] += output_frame_[i] * window_[i];
+        for (size_t i = 0; i < hop_; ++i)
+        {
+            float x = accumulator_[i];
+            x = x < -3.f ? -3.f : x > 3.f ? 3.f : x;
+            ready_[i] = x * (27.f + x * x) / (27.f + 9.f * x * x);
+        }
+        std::memmove(accumulator_, accumulator_ + hop_, (size_ - hop_) * sizeof(float));
+        std::memset(accumulator_ + size_ - hop_, 0, hop_ * sizeof(float));
+
+        std::memmove(modulator_frame_, modulator_frame_ + hop_, (size_ - hop_) * sizeof(float));
+        std::memmove(carrier_frame_, carrier_frame_ + hop_, (size_ - hop_) * sizeof(float));
+    }
+
+    static constexpr float kMaxGain = 100.0f;
+
+    RealFft<kFftVocoderMaxSize> fft_;
+    float sample_rate_;
+    size_t size_;
+    size_t hop_;
+    size_t fill_;
+    int num_bands_;
+    float attack_;
+    float release_;
+
+    size_t band_start_[kFftVocoderMaxBands + 1];
+    float envelope_[kFftVocoderMaxBands];
+
+    float window_[kFftVocoderMaxSize];
+    float modulator_frame_[kFftVocoderMaxSize];
+    float carrier_frame_[kFftVocoderMaxSize];
+    float output_frame_[kFftVocoderMaxSize];
+    float accumulator_[kFftVocoderMaxSize];
+    float ready_[kFftVocoderMaxSize / 2];
+    float modulator_re_[kFftVocoderMaxSize / 2 + 1];
+    float modulator_im_[kFftVocoderMaxSize / 2 + 1];
+    float carrier_re_[kFftVocoderMaxSize / 2 + 1];
+    float carrier_im_[kFftVocoderMaxSize / 2 + 1];
+};
+
+} // namespace pdmi
+
+#endif // PD_MI_FFT_VOCODER_H_
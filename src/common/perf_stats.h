@@ -0,0 +1,186 @@
+//
+//  perf_stats.h
+//  pd-mi
+//
+
+// Per-object timing of perform routines.
+//
+// PerfStats takes one sample per perform call: the elapsed count of the
+// cheapest monotonic counter there is (the TSC on x86, the virtual counter
+// on arm64, steady_clock elsewhere) and the vector size. It keeps count,
+// total and max plus a log histogram with 4 buckets per octave, which is
+// enough for p50/p99 within 10 %. Counter ticks are converted to ns only
+// when summarised, from the ticks and wall time elapsed since the last
+// Reset(), so there is no calibration loop.
+//
+// The perform routine is the only writer and only uses relaxed loads and
+// stores, no locked instructions; a reader on another thread sees counters
+// that may be one block apart but never torn values.
+//
+// Externals only pay for this when timing is switched on: they add a timed
+// wrapper of their perform routine instead of the plain one.
+
+#ifndef PD_MI_PERF_STATS_H_
+#define PD_MI_PERF_STATS_H_
+
+#include <m_pd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace pdmi
+{
+
+inline uint64_t perf_ticks()
+{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+struct PerfSummary
+{
+    uint64_t count; // blocks
+    double mean_ns;
+    double p50_ns;
+    double p99_ns;
+    double max_ns;
+    double load; // share of real time, 1 = the whole DSP budget
+};
+
+class PerfStats
+{
+public:
+    PerfStats() { Reset(); }
+
+    void Reset()
+    {
+        for (auto &bucket : histogram_)
+            bucket.store(0, std::memory_order_relaxed);
+        count_.store(0, std::memory_order_relaxed);
+        total_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+        samples_.store(0, std::memory_order_relaxed);
+        reset_ticks_ = perf_ticks();
+        reset_time_ = std::chrono::steady_clock::now();
+    }
+
+    // one perform call of size samples that took ticks
+    inline void Add(uint64_t ticks, int size)
+    {
+        Bump(histogram_[Bucket(ticks)], 1);
+        Bump(count_, 1);
+        Bump(total_, ticks);
+        Bump(samples_, size);
+        if (ticks > max_.load(std::memory_order_relaxed))
+            max_.store(ticks, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+
+    PerfSummary Summarize(double sample_rate) const
+    {
+        PerfSummary s = {};
+        s.count = count();
+        if (!s.count)
+            return s;
+
+        double elapsed_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - reset_time_).count();
+        double elapsed_ticks = static_cast<double>(perf_ticks() - reset_ticks_);
+        double ns_per_tick = elapsed_ticks > 0 ? elapsed_ns / elapsed_ticks : 1.0;
+
+        s.mean_ns = total_.load(std::memory_order_relaxed) * ns_per_tick / s.count;
+        s.p50_ns = Percentile(0.5, s.count) * ns_per_tick;
+        s.p99_ns = Percentile(0.99, s.count) * ns_per_tick;
+        s.max_ns = max_.load(std::memory_order_relaxed) * ns_per_tick;
+        double audio_ns = samples_.load(std::memory_order_relaxed) * 1e9 / sample_rate;
+        s.load = audio_ns > 0 ? total_.load(std::memory_order_relaxed) * ns_per_tick / audio_ns : 0.0;
+        return s;
+    }
+
+private:
+    static const int kSubBuckets = 4; // per octave
+    static const int kBuckets = 64 * kSubBuckets;
+
+    template <typename T, typename U>
+    static inline void Bump(std::atomic<T> &counter, U amount)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + static_cast<T>(amount), std::memory_order_relaxed);
+    }
+
+    static inline int Bucket(uint64_t ticks)
+    {
+        if (ticks < kSubBuckets)
+            return static_cast<int>(ticks);
+        int octave = 63;
+        while (!(ticks >> octave))
+            --octave;
+        int sub = static_cast<int>(ticks >> (octave - 2)) & (kSubBuckets - 1);
+        return octave * kSubBuckets + sub;
+    }
+
+    // middle of the bucket holding the q quantile, in ticks
+    double Percentile(double q, uint64_t count) const
+    {
+        uint64_t rank = static_cast<uint64_t>(q * (count - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < kBuckets; ++i)
+        {
+            seen += histogram_[i].load(std::memory_order_relaxed);
+            if (seen < rank)
+                continue;
+            if (i < kSubBuckets)
+                return i;
+            int octave = i / kSubBuckets;
+            int sub = i % kSubBuckets;
+            double low = static_cast<double>(kSubBuckets + sub) * (uint64_t(1) << (octave - 2));
+            return low + 0.5 * (uint64_t(1) << (octave - 2));
+        }
+        return static_cast<double>(max_.load(std::memory_order_relaxed));
+    }
+
+    std::atomic<uint32_t> histogram_[kBuckets];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> total_;
+    std::atomic<uint64_t> max_;
+    std::atomic<uint64_t> samples_;
+    uint64_t reset_ticks_;
+    std::chrono::steady_clock::time_point reset_time_;
+};
+
+// "count mean p50 p99 max load%" as atoms, for an info outlet
+inline int perf_atoms(const PerfSummary &s, t_atom *atoms)
+{
+    SETFLOAT(atoms + 0, static_cast<t_float>(s.count));
+    SETFLOAT(atoms + 1, static_cast<t_float>(s.mean_ns));
+    SETFLOAT(atoms + 2, static_cast<t_float>(s.p50_ns));
+    SETFLOAT(atoms + 3, static_cast<t_float>(s.p99_ns));
+    SETFLOAT(atoms + 4, static_cast<t_float>(s.max_ns));
+    SETFLOAT(atoms + 5, static_cast<t_float>(s.load * 100.0));
+    return 6;
+}
+
+inline void perf_post(const char *name, const PerfSummary &s)
+{
+    post("%s: %llu blocks, ns per block mean %.0f p50 %.0f p99 %.0f max %.0f, load %.2f %%", name,
+         static_cast<unsigned long long>(s.count), s.mean_ns, s.p50_ns, s.p99_ns, s.max_ns, s.load * 100.0);
+}
+
+} // namespace pdmi
+
+#endif // PD_MI_PERF_STATS_H_
@@ -0,0 +1,56 @@
+//
+//  random_state.h
+//  pd-mi
+//
+
+// Per-instance random state for the MI code.
+//
+// The noise sources and random engines all draw from stmlib::Random, which
+// has a single state. With more than one instance that state is shared, so
+// what one instance plays depends on what the others did before it, and
+// a render can't be repeated. Each external keeps a state of its own
+// instead, and RandomScope swaps it in for one perform call:
+//
+//     pdmi::RandomScope random(self->random_state);
+//
+// instance_seed() gives the nth instance of a class a different sequence.
+// The first instance gets stmlib's own seed, so a lone object sounds as it
+// did before. The 'seed' message sets the state, to restart a sequence.
+
+#ifndef PD_MI_RANDOM_STATE_H_
+#define PD_MI_RANDOM_STATE_H_
+
+#include "stmlib/utils/random.h"
+
+#include <cstdint>
+
+namespace pdmi
+{
+
+inline uint32_t instance_seed(uint32_t n)
+{
+    return 0x21u + n * 0x9e3779b9u;
+}
+
+// the state for a 'seed' argument; negative seeds wrap around
+inline uint32_t seed_state(double seed)
+{
+    return static_cast<uint32_t>(static_cast<int64_t>(seed));
+}
+
+class RandomScope
+{
+public:
+    explicit RandomScope(uint32_t &state) : state_(state) { stmlib::Random::Seed(state_); }
+    ~RandomScope() { state_ = stmlib::Random::state(); }
+
+    RandomScope(const RandomScope &) = delete;
+    RandomScope &operator=(const RandomScope &) = delete;
+
+private:
+    uint32_t &state_;
+};
+
+} // namespace pdmi
+
+#endif // PD_MI_RANDOM_STATE_H_
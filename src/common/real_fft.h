@@ -0,0 +1,148 @@
+//
+//  real_fft.h
+//  pd-mi
+//
+
+// Power of two real FFT: an iterative radix-2 complex FFT of half the size
+// plus the usual even/odd split. Tables are filled by Init, Forward and
+// Inverse don't allocate. Bins are 0..size/2 inclusive; Inverse(Forward(x))
+// returns x.
+
+#ifndef PD_MI_REAL_FFT_H_
+#define PD_MI_REAL_FFT_H_
+
+#include <cmath>
+#include <cstddef>
+
+namespace pdmi
+{
+
+template <size_t kMaxSize>
+class RealFft
+{
+public:
+    void Init(size_t size)
+    {
+        size_ = size;
+        half_ = size / 2;
+
+        int bits = 0;
+        while ((size_t(1) << bits) < half_)
+            ++bits;
+        for (size_t i = 0; i < half_; ++i)
+        {
+            size_t r = 0;
+            for (int b = 0; b < bits; ++b)
+                r |= ((i >> b) & 1) << (bits - 1 - b);
+            bit_reverse_[i] = r;
+        }
+        // twiddles of the half size complex FFT, then of the real split
+        for (size_t i = 0; i < half_ / 2; ++i)
+        {
+            double phase = -2.0 * M_PI * i / half_;
+            cos_[i] = static_cast<float>(cos(phase));
+            sin_[i] = static_cast<float>(sin(phase));
+        }
+        for (size_t k = 0; k <= half_; ++k)
+        {
+            double phase = -2.0 * M_PI * k / size;
+            split_cos_[k] = static_cast<float>(cos(phase));
+            split_sin_[k] = static_cast<float>(sin(phase));
+        }
+    }
+
+    size_t size() const { return size_; }
+
+    // in: size samples. re, im: size / 2 + 1 bins.
+    void Forward(const float *in, float *re, float *im)
+    {
+        for (size_t i = 0; i < half_; ++i)
+        {
+            size_t r = bit_reverse_[i];
+            zr_[r] = in[2 * i];
+            zi_[r] = in[2 * i + 1];
+        }
+        Butterflies(zr_, zi_);
+
+        re[0] = zr_[0] + zi_[0];
+        im[0] = 0.f;
+        re[half_] = zr_[0] - zi_[0];
+        im[half_] = 0.f;
+        for (size_t k = 1; k < half_; ++k)
+        {
+            float ar = zr_[k], ai = zi_[k];
+            float br = zr_[half_ - k], bi = -zi_[half_ - k]; // conj(Z[M - k])
+            float er = 0.5f * (ar + br), ei = 0.5f * (ai + bi);
+            // (Z[k] - conj(Z[M - k])) * -i / 2
+            float orr = 0.5f * (ai - bi), oi = -0.5f * (ar - br);
+            float wr = split_cos_[k], wi = split_sin_[k];
+            re[k] = er + wr * orr - wi * oi;
+            im[k] = ei + wr * oi + wi * orr;
+        }
+    }
+
+    // re, im: size / 2 + 1 bins. out: size samples.
+    void Inverse(const float *re, const float *im, float *out)
+    {
+        for (size_t k = 0; k < half_; ++k)
+        {
+            float ar = re[k], ai = im[k];
+            float br = re[half_ - k], bi = -im[half_ - k]; // conj(X[M - k])
+            float er = 0.5f * (ar + br), ei = 0.5f * (ai + bi);
+            float dr = 0.5f * (ar - br), di = 0.5f * (ai - bi);
+            // odd part: (X[k] - conj(X[M - k])) / 2 * conj(W^k)
+            float wr = split_cos_[k], wi = -split_sin_[k];
+            float orr = dr * wr - di * wi, oi = dr * wi + di * wr;
+            // Z = E + i O, conjugated for the inverse transform
+            size_t r = bit_reverse_[k];
+            zr_[r] = er - oi;
+            zi_[r] = -(ei + orr);
+        }
+        Butterflies(zr_, zi_);
+
+        float scale = 1.0f / static_cast<float>(half_);
+        for (size_t i = 0; i < half_; ++i)
+        {
+            out[2 * i] = zr_[i] * scale;
+            out[2 * i + 1] = -zi_[i] * scale;
+        }
+    }
+
+private:
+    // in place, input in bit reversed order
+    void Butterflies(float *xr, float *xi)
+    {
+        for (size_t span = 1; span < half_; span <<= 1)
+        {
+            size_t stride = half_ / (2 * span);
+            for (size_t start = 0; start < half_; start += 2 * span)
+            {
+                for (size_t j = 0; j < span; ++j)
+                {
+                    float wr = cos_[j * stride], wi = sin_[j * stride];
+                    size_t a = start + j, b = a + span;
+                    float tr = xr[b] * wr - xi[b] * wi;
+                    float ti = xr[b] * wi + xi[b] * wr;
+                    xr[b] = xr[a] - tr;
+                    xi[b] = xi[a] - ti;
+                    xr[a] += tr;
+                    xi[a] += ti;
+                }
+            }
+        }
+    }
+
+    size_t size_;
+    size_t half_;
+    size_t bit_reverse_[kMaxSize / 2];
+    float cos_[kMaxSize / 4];
+    float sin_[kMaxSize / 4];
+    float split_cos_[kMaxSize / 2 + 1];
+    float split_sin_[kMaxSize / 2 + 1];
+    float zr_[kMaxSize / 2];
+    float zi_[kMaxSize / 2];
+};
+
+} // namespace pdmi
+
+#endif // PD_MI_REAL_FFT_H_
@@ -0,0 +1,137 @@
+//
+//  resampler.h
+//  pd-mi
+//
+
+// 2x polyphase half-band up/down sampling, used to run the warps modulator
+// at (close to) its native 96 kHz from a 44.1/48 kHz host.
+//
+// The prototype is a 4 * kHalfbandOrder - 1 tap windowed-sinc half-band
+// filter. Every other tap is zero, so each output sample costs
+// 2 * kHalfbandOrder multiply-adds; the odd upsampler phase and the centre
+// tap of the downsampler are plain delays. Up and down together delay the
+// signal by 2 * kHalfbandOrder - 1 host-rate samples.
+//
+// Both classes are plain data and work on one channel of an interleaved
+// buffer (stride in floats), so a stereo warps::FloatFrame array takes one
+// instance per channel.
+
+#ifndef PD_MI_RESAMPLER_H_
+#define PD_MI_RESAMPLER_H_
+
+#include <cmath>
+#include <cstddef>
+
+namespace pdmi
+{
+
+const size_t kHalfbandOrder = 16;
+const size_t kHalfbandTaps = 2 * kHalfbandOrder; // non-zero taps, minus the centre
+
+// non-zero taps of the half-band prototype, normalised for unity DC gain
+inline void HalfbandInit(float *taps)
+{
+    const double center = 2.0 * kHalfbandOrder - 1.0;
+    const double length = 4.0 * kHalfbandOrder - 1.0;
+    double sum = 0.0;
+    for (size_t k = 0; k < kHalfbandTaps; ++k)
+    {
+        double n = 2.0 * k;
+        double d = n - center; // odd, so the sinc never hits its zero
+        double sinc = sin(M_PI * d * 0.5) / (M_PI * d * 0.5);
+        double window = 0.42 - 0.5 * cos(2.0 * M_PI * (n + 0.5) / length) +
+                        0.08 * cos(4.0 * M_PI * (n + 0.5) / length);
+        taps[k] = static_cast<float>(0.5 * sinc * window);
+        sum += taps[k];
+    }
+    for (size_t k = 0; k < kHalfbandTaps; ++k)
+        taps[k] = static_cast<float>(taps[k] * 0.5 / sum);
+}
+
+// the taps times x, in independent sums that vectorise
+inline float HalfbandDot(const float *taps, const float *x)
+{
+    const size_t kLanes = 8;
+    static_assert(kHalfbandTaps % kLanes == 0, "taps in whole lanes");
+    float sum[kLanes] = {};
+    for (size_t k = 0; k < kHalfbandTaps; k += kLanes)
+        for (size_t j = 0; j < kLanes; ++j)
+            sum[j] += taps[k + j] * x[k + j];
+    return ((sum[0] + sum[4]) + (sum[1] + sum[5])) + ((sum[2] + sum[6]) + (sum[3] + sum[7]));
+}
+
+class Upsampler2x
+{
+public:
+    void Init()
+    {
+        HalfbandInit(taps_);
+        for (size_t i = 0; i < 2 * kHalfbandTaps; ++i)
+            history_[i] = 0.f;
+        head_ = 0;
+    }
+
+    // in: size samples, out: 2 * size samples
+    void Process(const float *in, float *out, size_t size, size_t stride)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            // the history is stored twice so the taps always read contiguously
+            head_ = head_ == 0 ? kHalfbandTaps - 1 : head_ - 1;
+            history_[head_] = history_[head_ + kHalfbandTaps] = in[i * stride];
+
+            const float *x = &history_[head_];
+            float even = HalfbandDot(taps_, x);
+
+            out[(2 * i) * stride] = 2.f * even;
+            out[(2 * i + 1) * stride] = x[kHalfbandOrder - 1];
+        }
+    }
+
+private:
+    float taps_[kHalfbandTaps];
+    float history_[2 * kHalfbandTaps];
+    size_t head_;
+};
+
+class Downsampler2x
+{
+public:
+    void Init()
+    {
+        HalfbandInit(taps_);
+        for (size_t i = 0; i < 2 * kHalfbandTaps; ++i)
+            even_[i] = 0.f;
+        for (size_t i = 0; i < 2 * kHalfbandOrder; ++i)
+            odd_[i] = 0.f;
+        even_head_ = 0;
+        odd_head_ = 0;
+    }
+
+    // in: 2 * size samples, out: size samples
+    void Process(const float *in, float *out, size_t size, size_t stride)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            even_head_ = even_head_ == 0 ? kHalfbandTaps - 1 : even_head_ - 1;
+            even_[even_head_] = even_[even_head_ + kHalfbandTaps] = in[(2 * i) * stride];
+
+            const float *x = &even_[even_head_];
+            out[i * stride] = HalfbandDot(taps_, x) + 0.5f * odd_[odd_head_ + kHalfbandOrder - 1];
+
+            odd_head_ = odd_head_ == 0 ? kHalfbandOrder - 1 : odd_head_ - 1;
+            odd_[odd_head_] = odd_[odd_head_ + kHalfbandOrder] = in[(2 * i + 1) * stride];
+        }
+    }
+
+private:
+    float taps_[kHalfbandTaps];
+    float even_[2 * kHalfbandTaps];
+    float odd_[2 * kHalfbandOrder];
+    size_t even_head_;
+    size_t odd_head_;
+};
+
+} // namespace pdmi
+
+#endif // PD_MI_RESAMPLER_H_
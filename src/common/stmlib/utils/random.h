@@ -0,0 +1,59 @@
+//
+//  stmlib/utils/random.h
+//  pd-mi
+//
+
+// Stands in for stmlib's random.h in all three MI source trees: the common
+// directory comes first on the include path, and the include guard is the
+// same, so the MI code gets this one and stmlib/utils/random.cc is not
+// built.
+//
+// The interface is stmlib's. The difference is that the state is
+// thread_local instead of one variable for the whole process, so instances
+// rendering on different threads don't race on it. Which instance's
+// sequence is drawn from is up to pdmi::RandomScope (random_state.h).
+//
+// The state uses the initial-exec TLS model where there is one (ELF): the
+// default for a dlopen()ed external allocates a thread's copy with malloc
+// on its first access, which would be in a perform routine or a worker.
+
+#ifndef STMLIB_UTILS_RANDOM_H_
+#define STMLIB_UTILS_RANDOM_H_
+
+#include "stmlib/stmlib.h"
+
+#if defined(__ELF__) && (defined(__GNUC__) || defined(__clang__))
+#define PD_MI_STATIC_TLS __attribute__((tls_model("initial-exec")))
+#else
+#define PD_MI_STATIC_TLS
+#endif
+
+namespace stmlib
+{
+
+class Random
+{
+public:
+    static inline uint32_t state() { return rng_state_; }
+
+    static inline void Seed(uint32_t seed) { rng_state_ = seed; }
+
+    static inline uint32_t GetWord()
+    {
+        rng_state_ = rng_state_ * 1664525L + 1013904223L;
+        return state();
+    }
+
+    static inline int16_t GetSample() { return static_cast<int16_t>(GetWord() >> 16); }
+
+    static inline float GetFloat() { return static_cast<float>(GetWord()) / 4294967296.0f; }
+
+private:
+    static inline thread_local uint32_t rng_state_ PD_MI_STATIC_TLS = 0x21;
+
+    DISALLOW_COPY_AND_ASSIGN(Random);
+};
+
+} // namespace stmlib
+
+#endif // STMLIB_UTILS_RANDOM_H_
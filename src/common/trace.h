@@ -0,0 +1,259 @@
+//
+//  trace.h
+//  pd-mi
+//
+
+// Timeline tracing of perform calls, for finding dropouts.
+//
+// Built only with PD_MI_TRACE defined (cmake -DPD_MI_TRACE=ON); otherwise
+// TraceTrack is an empty struct whose methods compile to nothing and
+// trace_dump() just reports that tracing is off.
+//
+// Each object keeps a TraceTrack, which numbers its perform calls. Events go
+// into one ring buffer per binary (the last kTraceCapacity of them), shared
+// by all four externals in the pd-mi library: the writer claims a slot with
+// a fetch_add and publishes it with a sequence number, so the perform
+// routine never waits, and a snapshot skips slots that are being
+// overwritten. Times are counter ticks (see perf_stats.h), converted when
+// dumping.
+//
+// 'trace_dump <file>' copies the buffer and writes it from a separate thread
+// as Chrome Trace Event JSON, one track per object, which Perfetto
+// (ui.perfetto.dev) and chrome://tracing open.
+
+#ifndef PD_MI_TRACE_H_
+#define PD_MI_TRACE_H_
+
+#include <m_pd.h>
+
+#include <cstdint>
+
+#ifdef PD_MI_TRACE
+#include "perf_stats.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#endif
+
+namespace pdmi
+{
+
+#ifdef PD_MI_TRACE
+
+const size_t kTraceCapacity = 1 << 16; // events
+
+struct TraceEvent
+{
+    uint64_t begin; // ticks
+    uint64_t end;   // ticks
+    const void *object;
+    const char *name; // string literal
+    uint32_t block;   // perform call index of the object
+    int32_t value;
+    bool instant;
+};
+
+class TraceBuffer
+{
+public:
+    TraceBuffer() : head_(0)
+    {
+        for (auto &slot : slots_)
+            slot.sequence.store(0, std::memory_order_relaxed);
+        origin_ticks_ = perf_ticks();
+        origin_time_ = std::chrono::steady_clock::now();
+    }
+
+    inline void Record(const TraceEvent &event)
+    {
+        uint64_t index = head_.fetch_add(1, std::memory_order_relaxed);
+        Slot &slot = slots_[index & (kTraceCapacity - 1)];
+        slot.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.event = event;
+        slot.sequence.store(index + 1, std::memory_order_release);
+    }
+
+    // the complete events still in the buffer, oldest first
+    void Snapshot(std::vector<TraceEvent> &events) const
+    {
+        uint64_t head = head_.load(std::memory_order_acquire);
+        uint64_t first = head > kTraceCapacity ? head - kTraceCapacity : 0;
+        events.clear();
+        events.reserve(head - first);
+        for (uint64_t index = first; index < head; ++index)
+        {
+            const Slot &slot = slots_[index & (kTraceCapacity - 1)];
+            if (slot.sequence.load(std::memory_order_acquire) != index + 1)
+                continue;
+            TraceEvent event = slot.event;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == index + 1)
+                events.push_back(event);
+        }
+    }
+
+    double ns_per_tick() const
+    {
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - origin_time_).count();
+        double ticks = static_cast<double>(perf_ticks() - origin_ticks_);
+        return ticks > 0 ? ns / ticks : 1.0;
+    }
+
+    uint64_t origin_ticks() const { return origin_ticks_; }
+
+private:
+    struct Slot
+    {
+        std::atomic<uint64_t> sequence; // index + 1 once written
+        TraceEvent event;
+    };
+
+    std::atomic<uint64_t> head_;
+    Slot slots_[kTraceCapacity];
+    uint64_t origin_ticks_;
+    std::chrono::steady_clock::time_point origin_time_;
+};
+
+inline TraceBuffer &trace_buffer()
+{
+    static TraceBuffer *buffer = new TraceBuffer; // never freed, 3 MB
+    return *buffer;
+}
+
+// Creates the buffer, from each class's setup: built lazily on the first
+// event it would cost a perform call 3 MB of allocation and clearing.
+inline void trace_setup()
+{
+    trace_buffer();
+}
+
+// Per object, zeroed by pd_new.
+struct TraceTrack
+{
+    uint32_t block;
+    int32_t last_value;
+
+    inline uint64_t Begin() const { return perf_ticks(); }
+
+    // a span that started at begin
+    inline void End(const void *object, const char *name, uint64_t begin)
+    {
+        trace_buffer().Record({begin, perf_ticks(), object, name, block, 0, false});
+    }
+
+    // the perform call that started at begin, advances the block index
+    inline void EndPerform(const void *object, uint64_t begin)
+    {
+        End(object, "perform", begin);
+        ++block;
+    }
+
+    inline void Instant(const void *object, const char *name, int32_t value)
+    {
+        uint64_t now = perf_ticks();
+        trace_buffer().Record({now, now, object, name, block, value, true});
+    }
+
+    // an instant event whenever value differs from the last one, for state
+    // that only the perform routine sees change (one per track)
+    inline void Change(const void *object, const char *name, int32_t value)
+    {
+        if (value == last_value)
+            return;
+        last_value = value;
+        Instant(object, name, value);
+    }
+};
+
+inline bool trace_write_json(const std::string &path, const std::string &process,
+                             const std::vector<TraceEvent> &events, uint64_t origin, double ns_per_tick)
+{
+    FILE *f = fopen(path.c_str(), "w");
+    if (!f)
+        return false;
+
+    std::map<const void *, int> tracks;
+    for (const TraceEvent &event : events)
+        tracks.insert({event.object, static_cast<int>(tracks.size()) + 1});
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"%s\"}}", process.c_str());
+    for (const auto &track : tracks)
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %p\"}}",
+                track.second, process.c_str(), track.first);
+
+    for (const TraceEvent &event : events)
+    {
+        double ts = static_cast<double>(static_cast<int64_t>(event.begin - origin)) * ns_per_tick * 1e-3; // us
+        int tid = tracks[event.object];
+        if (!event.instant)
+        {
+            double dur = static_cast<double>(event.end - event.begin) * ns_per_tick * 1e-3;
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                       "\"args\":{\"block\":%u}}",
+                    event.name, tid, ts, dur, event.block);
+        }
+        else
+        {
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+                       "\"args\":{\"block\":%u,\"value\":%d}}",
+                    event.name, tid, ts, event.block, event.value);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0;
+}
+
+// Copies the buffer and leaves the formatting and the file to a thread of
+// its own. The thread can't post to the Pd console, so a failed write goes
+// to stderr.
+inline void trace_dump(t_object *owner, const char *process, t_symbol *file)
+{
+    if (!file || !*file->s_name)
+    {
+        pd_error(owner, "%s: trace_dump needs a file name", process);
+        return;
+    }
+    std::vector<TraceEvent> events;
+    trace_buffer().Snapshot(events);
+    uint64_t origin = trace_buffer().origin_ticks();
+    double ns_per_tick = trace_buffer().ns_per_tick();
+    post("%s: writing %zu trace events to %s", process, events.size(), file->s_name);
+
+    std::thread([path = std::string(file->s_name), name = std::string(process), events = std::move(events),
+                 origin, ns_per_tick]() {
+        if (!trace_write_json(path, name, events, origin, ns_per_tick))
+            fprintf(stderr, "%s: couldn't write trace to %s\n", name.c_str(), path.c_str());
+    }).detach();
+}
+
+#else // PD_MI_TRACE
+
+struct TraceTrack
+{
+    inline uint64_t Begin() const { return 0; }
+    inline void End(const void *, const char *, uint64_t) {}
+    inline void EndPerform(const void *, uint64_t) {}
+    inline void Instant(const void *, const char *, int) {}
+    inline void Change(const void *, const char *, int) {}
+};
+
+inline void trace_setup() {}
+
+inline void trace_dump(t_object *owner, const char *process, t_symbol *)
+{
+    pd_error(owner, "%s: built without tracing, configure with -DPD_MI_TRACE=ON", process);
+}
+
+#endif // PD_MI_TRACE
+
+} // namespace pdmi
+
+#endif // PD_MI_TRACE_H_
@@ -0,0 +1,290 @@
+//
+//  worker_pool.h
+//  pd-mi
+//
+
+// A fixed set of worker threads that run independent jobs (one per voice)
+// alongside the rest of a DSP tick.
+//
+// The audio thread calls Launch() to hand out jobs 0..jobs-1 and returns
+// right away, so the workers render while Pd computes the rest of the
+// graph. At the next tick Finish() runs whatever hasn't been started yet
+// on the audio thread itself and waits for the jobs in progress. The
+// results are always complete one tick later, even if the workers didn't
+// get a core in time; with no workers at all Finish() does everything.
+//
+// The jobs are split into one contiguous range per worker. A worker takes
+// jobs off its own range through an atomic cursor and, once that is
+// empty, steals from the other ranges the same way, and so does Finish().
+// Nothing is allocated and no lock is taken after Start(): the handoff is
+// a round counter that idle workers spin on for a while and then sleep on
+// (a futex on Linux, short sleeps elsewhere).
+//
+// On Linux each worker is pinned to its own CPU, taken from the ones the
+// process may run on, skipping the first. Workers run with flush-to-zero
+// set, like the perform routines.
+//
+// Start() and Stop() are for the message thread (new and free), Launch()
+// and Finish() for the audio thread. Nothing may touch the jobs' data from
+// Launch() until Finish() returns.
+
+#ifndef PD_MI_WORKER_POOL_H_
+#define PD_MI_WORKER_POOL_H_
+
+#include "denormals.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <system_error>
+#include <thread>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace pdmi
+{
+
+class WorkerPool
+{
+public:
+    typedef void (*t_job)(void *context, int job);
+
+    static constexpr int kMaxWorkers = 64;
+
+    WorkerPool()
+        : job_(nullptr), context_(nullptr), jobs_(0), num_workers_(0), num_ranges_(1), launched_(false),
+          done_(0), round_(0), sleepers_(0), quit_(false)
+    {
+    }
+
+    ~WorkerPool() { Stop(); }
+
+    // Starts up to workers threads for a fixed number of jobs per round.
+    // Returns how many threads could be started, which can be fewer (or
+    // none) if the system refuses.
+    int Start(int workers, int jobs, bool pin, t_job job, void *context)
+    {
+        Stop();
+        job_ = job;
+        context_ = context;
+        jobs_ = jobs;
+        quit_.store(false);
+        num_workers_ = 0;
+        workers = std::clamp(workers, 0, std::min(kMaxWorkers, jobs));
+        uint32_t round = round_.load();
+        for (int i = 0; i < workers; ++i)
+        {
+            cpus_[i] = -1;
+            try
+            {
+                threads_[i] = std::thread(&WorkerPool::Run, this, i, round);
+            }
+            catch (const std::system_error &)
+            {
+                break;
+            }
+            num_workers_++;
+        }
+
+        num_ranges_ = std::max(num_workers_, 1);
+        for (int i = 0; i < num_ranges_; ++i)
+        {
+            ranges_[i].end = jobs_ * (i + 1) / num_ranges_;
+            ranges_[i].next.store(ranges_[i].end);
+        }
+        if (pin)
+            Pin();
+        return num_workers_;
+    }
+
+    void Stop()
+    {
+        launched_ = false;
+        if (!num_workers_)
+            return;
+        quit_.store(true);
+        round_.fetch_add(1);
+        Wake();
+        for (int i = 0; i < num_workers_; ++i)
+            threads_[i].join();
+        num_workers_ = 0;
+        num_ranges_ = 1;
+    }
+
+    // hands out the next round of jobs
+    void Launch()
+    {
+        done_.store(0, std::memory_order_relaxed);
+        for (int i = 0; i < num_ranges_; ++i)
+            ranges_[i].next.store(jobs_ * i / num_ranges_, std::memory_order_release);
+        launched_ = true;
+        if (!num_workers_)
+            return;
+        round_.fetch_add(1);
+        if (sleepers_.load() > 0)
+            Wake();
+    }
+
+    // runs the jobs no worker has taken and waits for the others
+    void Finish()
+    {
+        if (!launched_)
+            return;
+        Work(0);
+        while (done_.load(std::memory_order_acquire) < jobs_)
+            Pause();
+        launched_ = false;
+    }
+
+    // a round was launched and isn't finished yet
+    bool launched() const { return launched_; }
+
+    int workers() const { return num_workers_; }
+
+    // the CPU worker i is pinned to, or -1
+    int cpu(int i) const { return i < num_workers_ ? cpus_[i] : -1; }
+
+private:
+    // pause instructions before an idle worker goes to sleep, some 10-100 us
+    static constexpr int kSpins = 2000;
+
+    struct alignas(64) t_range
+    {
+        std::atomic<int> next;
+        int end; // set in Start() only
+    };
+
+    static void Pause()
+    {
+#if defined(__SSE2__) || defined(_M_X64)
+        _mm_pause();
+#elif defined(__aarch64__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+
+    // seen: the round when the pool was started, workers wait for the next
+    void Run(int index, uint32_t seen)
+    {
+        ScopedFlushDenormals flush;
+        while (true)
+        {
+            uint32_t round = WaitForRound(seen);
+            if (quit_.load())
+                return;
+            seen = round;
+            Work(index);
+        }
+    }
+
+    // takes jobs from range first and then the following ones
+    void Work(int first)
+    {
+        for (int i = 0; i < num_ranges_; ++i)
+        {
+            t_range &range = ranges_[(first + i) % num_ranges_];
+            int job;
+            while ((job = range.next.fetch_add(1, std::memory_order_acq_rel)) < range.end)
+            {
+                job_(context_, job);
+                done_.fetch_add(1, std::memory_order_release);
+            }
+        }
+    }
+
+    uint32_t WaitForRound(uint32_t seen)
+    {
+        for (int i = 0; i < kSpins; ++i)
+        {
+            uint32_t round = round_.load(std::memory_order_acquire);
+            if (round != seen)
+                return round;
+            Pause();
+        }
+        // Launch() increments the round before it reads sleepers_, a worker
+        // increments sleepers_ before it reads the round: one of them sees
+        // the other, so no wakeup is lost
+        sleepers_.fetch_add(1);
+        uint32_t round;
+        while ((round = round_.load()) == seen)
+            Sleep(seen);
+        sleepers_.fetch_sub(1);
+        return round;
+    }
+
+#if defined(__linux__)
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex on std::atomic");
+
+    void Sleep(uint32_t seen)
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&round_), FUTEX_WAIT_PRIVATE, seen, nullptr, nullptr, 0);
+    }
+
+    void Wake()
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&round_), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr,
+                0);
+    }
+
+    void Pin()
+    {
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+            return;
+        int cpus[CPU_SETSIZE];
+        int count = 0;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &allowed))
+                cpus[count++] = cpu;
+        // leave the first one to the audio thread, unless it is the only one
+        int first = count > 1 ? 1 : 0;
+        for (int i = 0; i < num_workers_ && count > 0; ++i)
+        {
+            int cpu = cpus[first + i % (count - first)];
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            if (pthread_setaffinity_np(threads_[i].native_handle(), sizeof(set), &set) == 0)
+                cpus_[i] = cpu;
+        }
+    }
+#else
+    void Sleep(uint32_t) { std::this_thread::sleep_for(std::chrono::microseconds(50)); }
+
+    void Wake() {}
+
+    void Pin() {}
+#endif
+
+    t_job job_;
+    void *context_;
+    int jobs_;
+    int num_workers_;
+    int num_ranges_;
+    bool launched_; // audio thread only
+
+    std::thread threads_[kMaxWorkers];
+    int cpus_[kMaxWorkers] = {};
+    t_range ranges_[kMaxWorkers];
+
+    alignas(64) std::atomic<int> done_;
+    alignas(64) std::atomic<uint32_t> round_;
+    std::atomic<int> sleepers_;
+    std::atomic<bool> quit_;
+};
+
+} // namespace pdmi
+
+#endif // PD_MI_WORKER_POOL_H_
@@ -0,0 +1,40 @@
+//
+//  pd-mi.cpp
+//  pd-mi
+//
+
+// The pd-mi library: all four externals in one binary, for 'pd -lib pd-mi'
+// or a [declare -lib pd-mi]. Setting it up registers the classes the same
+// way loading them one by one would, so patches don't change.
+//
+// The code shared between externals is linked once: tds~ and wrps~ use the
+// same stmlib. plts~ (64 bit stmlib) and wraps~ (eurorack stmlib and warps)
+// bring versions of their own, compiled under other namespace names, see
+// CMakeLists.txt.
+//
+// pd.mi.plts_pool~ is not part of it: its voices render on worker threads
+// while plts~ may set the plaits sample rate globals on the audio thread,
+// so it keeps a copy of plaits of its own.
+
+#include <m_pd.h>
+
+extern "C"
+{
+    void setup_pd0x2emi0x2eplts_tilde(void);
+    void setup_pd0x2emi0x2etds_tilde(void);
+    void setup_pd0x2emi0x2ewrps_tilde(void);
+    void setup_pd0x2emi0x2ewraps_tilde(void);
+
+    extern void setup_pd0x2dmi(void)
+    {
+        setup_pd0x2emi0x2eplts_tilde();
+        setup_pd0x2emi0x2etds_tilde();
+        setup_pd0x2emi0x2ewrps_tilde();
+        setup_pd0x2emi0x2ewraps_tilde();
+
+        post("pd-mi: pd.mi.plts~ pd.mi.tds~ pd.mi.wrps~ pd.mi.wraps~");
+        post("by przemysław sanecki --> https://software-materialism.org");
+        post("based on vb.mi by volker böhm --> https://vboehm.net");
+        post("clones of mutable instruments' 'plaits', 'tides' and 'warps' modules");
+    }
+}
@@ -0,0 +1,620 @@
+//
+//  pd.mi.plts_pool_tilde.cpp
+//  pd-mi
+//
+
+// pd.mi.plts_pool~: a pool of plaits voices rendered on worker threads.
+//
+// Pd computes DSP on one thread, so a patch with many plts~ keeps one core
+// busy and leaves the others idle. This object owns all the voices itself
+// and renders them in parallel on a fixed set of worker threads (see
+// worker_pool.h) while Pd runs the rest of the graph. The voices are mixed
+// into the two outlets on the audio thread one tick later, so the output
+// is one Pd vector late: 'latency' reports it.
+//
+//   [pd.mi.plts_pool~ <voices> @threads N @pin 0|1 @engine E @drone 0|1]
+//
+// voices defaults to 8. @threads defaults to one less than the number of
+// CPUs; 0 renders everything on the audio thread. @pin 0 leaves the
+// workers unpinned.
+//
+// The patch (engine, harmonics, timbre, morph, decay, lpg_colour) is
+// shared by all voices. 'note <pitch> [velocity]' plays a note on a free
+// voice, or the one that got a note longest ago. 'voice <n> <pitch>
+// [velocity]' plays one on voice n. The velocity (0-1, default 1) scales
+// the voice. Notes ping the low pass gate like plts~' trigger input, so
+// voices decay by themselves. With @drone 1 they sound continuously
+// instead, and a note with velocity 0 silences its voice. Notes start at
+// the next round of the pool, which is the vector size rounded up to the
+// plaits block size.
+//
+// The plaits code keeps the sample rate in globals, so all pools run at
+// Pd's rate. A pool in a resampled subpatch reports an error and stays
+// silent.
+
+// Original code by Émilie Gillet, https://mutable-instruments.net/
+#include <m_pd.h>
+
+#include "plaits/dsp/dsp.h"
+#include "plaits/dsp/voice.h"
+#include "denormals.h"
+#include "random_state.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+using std::clamp;
+
+const size_t kBlockSize = plaits::kBlockSize;
+const int kMaxVoices = 256;
+const size_t kSharedBufferBytes = 32768;
+
+// The plaits code reads the sample rate from these globals, so every pool
+// in the binary renders at one rate: Pd's, set in the dsp method once no
+// round of any pool is in flight. A pool running at another rate (in a
+// resampled subpatch) stays silent.
+double kSampleRate = 48000.0;
+double a0 = (440.0 / 8.0) / kSampleRate;
+
+static t_class *this_class = nullptr;
+static uint32_t voice_count = 0; // for the default seeds
+
+// One voice. The render side is written by the audio thread between
+// rounds and read by whichever thread renders the voice; the message side
+// is applied at the start of the next round.
+struct t_voice
+{
+    plaits::Voice voice;
+    char *shared_buffer;
+    double *out; // one round
+    double *aux;
+    uint32_t random_state;
+    std::atomic<long> nan_resets;
+
+    // render side
+    plaits::Patch patch;
+    plaits::Modulations modulations;
+    bool trigger;        // ping at the start of the round
+    float gain;          // reached at the end of the round
+    float previous_gain; // at its start
+
+    // message side
+    double note;
+    float velocity;
+    bool pending_trigger;
+    long age; // when it last got a note
+};
+
+struct t_myObj
+{
+    t_object m_obj; // pd object - always placed in first in the object's struct
+
+    t_voice *voices;
+    int num_voices;
+    pdmi::WorkerPool *pool;
+    int threads; // asked for
+    bool pin;
+
+    plaits::Patch patch; // shared, the note is per voice
+    bool drone;
+    long note_count; // clock for the voice allocation
+    uint32_t seed;   // from the seed message, for the next round
+    bool seed_pending;
+
+    double sr;
+    bool sr_ok; // runs at kSampleRate
+    int vs;
+    size_t round_frames; // vs rounded up to the plaits block size
+
+    // mixed rounds, read one Pd vector at a time
+    t_sample *fifo[2];
+    size_t fifo_size; // round_frames + vs
+    size_t fifo_read;
+    size_t fifo_available;
+
+    t_outlet *m_out;
+    t_outlet *m_aux;
+    t_outlet *info_out;
+
+    t_myObj *next_pool; // all pools in the binary
+};
+
+static t_myObj *pools = nullptr;
+
+void setSr(double newsr)
+{
+    kSampleRate = newsr;
+    a0 = (440.0 / 8.0) / kSampleRate;
+}
+
+static void myObj_render_voice(void *context, int index);
+
+static void *myObj_new(t_symbol *s, int argc, t_atom *argv)
+{
+    t_myObj *self = (t_myObj *)pd_new(this_class);
+
+    if (self)
+    {
+        self->m_out = outlet_new((t_object *)self, &s_signal); // 'out' output
+        self->m_aux = outlet_new((t_object *)self, &s_signal); // 'aux' output
+        self->info_out = outlet_new((t_object *)self, &s_anything);
+
+        self->num_voices = 8;
+        self->threads = std::max(1, (int)std::thread::hardware_concurrency()) - 1;
+        self->pin = true;
+        self->drone = false;
+        self->note_count = 0;
+        self->seed = 0;
+        self->seed_pending = false;
+
+        // plts~' defaults, and a decay that lets notes ring
+        self->patch.note = 48.0;
+        self->patch.harmonics = 0.1;
+        self->patch.decay = 0.5;
+        self->patch.lpg_colour = 0.5;
+
+        // attributes ====
+        int argnum = 0;
+        while (argc > 0)
+        {
+            if (argv->a_type == A_FLOAT)
+            {
+                t_float argval = atom_getfloatarg(0, argc, argv);
+                if (argnum == 0)
+                    self->num_voices = clamp((int)argval, 1, kMaxVoices);
+                argnum++;
+                argc--;
+                argv++;
+            }
+            else if (argv->a_type == A_SYMBOL && argc >= 2)
+            {
+                const char *name = atom_getsymbolarg(0, argc, argv)->s_name;
+                t_float argval = atom_getfloatarg(1, argc, argv);
+                if (strcmp(name, "@threads") == 0)
+                    self->threads = clamp((int)argval, 0, pdmi::WorkerPool::kMaxWorkers);
+                else if (strcmp(name, "@pin") == 0)
+                    self->pin = argval != 0.f;
+                else if (strcmp(name, "@engine") == 0)
+                    self->patch.engine = static_cast<int>(argval);
+                else if (strcmp(name, "@drone") == 0)
+                    self->drone = argval != 0.f;
+                argc -= 2;
+                argv += 2;
+            }
+            else
+            {
+                argc -= 1;
+                argv += 1;
+            }
+        }
+        // end of attributes
+
+        self->sr = sys_getsr();
+        if (self->sr <= 0)
+            self->sr = 44100.0;
+        self->sr_ok = false;
+        // with other pools about, their workers may be reading the rate
+        if (!pools)
+            setSr(self->sr);
+
+        self->voices = new t_voice[self->num_voices];
+        for (int i = 0; i < self->num_voices; ++i)
+        {
+            t_voice &v = self->voices[i];
+            v.shared_buffer = (char *)getbytes(kSharedBufferBytes);
+            stmlib::BufferAllocator allocator(v.shared_buffer, kSharedBufferBytes);
+            v.voice.Init(&allocator);
+            v.out = nullptr;
+            v.aux = nullptr;
+            v.random_state = pdmi::instance_seed(voice_count++);
+            v.nan_resets = 0;
+            v.patch = self->patch;
+            v.modulations = plaits::Modulations();
+            v.trigger = false;
+            v.gain = v.previous_gain = 0.f;
+            v.note = self->patch.note;
+            v.velocity = 0.f;
+            v.pending_trigger = false;
+            v.age = 0;
+        }
+
+        self->vs = 0;
+        self->round_frames = 0;
+        self->fifo[0] = self->fifo[1] = nullptr;
+        self->fifo_size = 0;
+        self->fifo_read = 0;
+        self->fifo_available = 0;
+
+        self->next_pool = pools;
+        pools = self;
+
+        self->pool = new pdmi::WorkerPool;
+        int started = self->pool->Start(self->threads, self->num_voices, self->pin, myObj_render_voice, self);
+        if (started < std::min(self->threads, self->num_voices))
+            pd_error((t_object *)self, "pd.mi.plts_pool~: started %d of %d worker threads", started,
+                     self->threads);
+    }
+    return (void *)self;
+}
+
+#pragma mark----- voices -----
+
+// a free voice, the oldest first, or else the one that got a note longest ago
+static int myObj_allocate(t_myObj *self)
+{
+    int best = 0;
+    for (int i = 1; i < self->num_voices; ++i)
+    {
+        const t_voice &v = self->voices[i];
+        const t_voice &b = self->voices[best];
+        bool free = v.velocity <= 0.f, best_free = b.velocity <= 0.f;
+        if ((free && !best_free) || (free == best_free && v.age < b.age))
+            best = i;
+    }
+    return best;
+}
+
+static void myObj_play(t_myObj *self, int index, double pitch, float velocity)
+{
+    t_voice &v = self->voices[index];
+    if (velocity <= 0.f)
+    {
+        // pinged voices decay anyway, drones stop here
+        if (self->drone)
+            v.velocity = 0.f;
+        return;
+    }
+    v.note = pitch;
+    v.velocity = std::min(velocity, 1.f);
+    v.pending_trigger = true;
+    v.age = ++self->note_count;
+}
+
+void myObj_note(t_myObj *self, t_symbol *s, int argc, t_atom *argv)
+{
+    if (argc < 1)
+        return;
+    double pitch = atom_getfloatarg(0, argc, argv);
+    float velocity = argc > 1 ? atom_getfloatarg(1, argc, argv) : 1.f;
+    if (velocity <= 0.f)
+    {
+        for (int i = 0; i < self->num_voices; ++i)
+            if (self->voices[i].velocity > 0.f && self->voices[i].note == pitch)
+                myObj_play(self, i, pitch, 0.f);
+        return;
+    }
+    myObj_play(self, myObj_allocate(self), pitch, velocity);
+}
+
+void myObj_voice(t_myObj *self, t_symbol *s, int argc, t_atom *argv)
+{
+    if (argc < 2)
+        return;
+    int index = (int)atom_getfloatarg(0, argc, argv);
+    if (index < 0 || index >= self->num_voices)
+    {
+        pd_error((t_object *)self, "pd.mi.plts_pool~: no voice %d", index);
+        return;
+    }
+    float velocity = argc > 2 ? atom_getfloatarg(2, argc, argv) : 1.f;
+    myObj_play(self, index, atom_getfloatarg(1, argc, argv), velocity);
+}
+
+void myObj_off(t_myObj *self)
+{
+    for (int i = 0; i < self->num_voices; ++i)
+        self->voices[i].velocity = 0.f;
+}
+
+void myObj_drone(t_myObj *self, t_floatarg d)
+{
+    self->drone = d != 0.f;
+}
+
+// voices can be rendering: the seed is applied with the next round
+void myObj_seed(t_myObj *self, t_floatarg s)
+{
+    self->seed = pdmi::seed_state(s);
+    self->seed_pending = true;
+}
+
+#pragma mark----- patch -----
+
+void myObj_engine(t_myObj *self, t_floatarg e)
+{
+    self->patch.engine = static_cast<int>(e);
+}
+
+void myObj_harmonics(t_myObj *self, t_floatarg h)
+{
+    self->patch.harmonics = clamp(static_cast<double>(h), 0.0, 1.0);
+}
+
+void myObj_timbre(t_myObj *self, t_floatarg t)
+{
+    self->patch.timbre = clamp(static_cast<double>(t), 0., 1.);
+}
+
+void myObj_morph(t_myObj *self, t_floatarg m)
+{
+    self->patch.morph = clamp(static_cast<double>(m), 0., 1.);
+}
+
+void myObj_decay(t_myObj *self, t_floatarg m)
+{
+    self->patch.decay = clamp(static_cast<double>(m), 0., 1.);
+}
+
+void myObj_lpg_colour(t_myObj *self, t_floatarg m)
+{
+    self->patch.lpg_colour = clamp(static_cast<double>(m), 0., 1.);
+}
+
+#pragma mark----- info -----
+
+void myObj_info(t_myObj *self)
+{
+    long nan_resets = 0;
+    for (int i = 0; i < self->num_voices; ++i)
+        nan_resets += self->voices[i].nan_resets.load(std::memory_order_relaxed);
+
+    logpost((t_object *)self, 3, "voices: %d", self->num_voices);
+    logpost((t_object *)self, 3, "worker threads: %d", self->pool->workers());
+    for (int i = 0; i < self->pool->workers(); ++i)
+        if (self->pool->cpu(i) >= 0)
+            logpost((t_object *)self, 3, "worker %d: cpu %d", i, self->pool->cpu(i));
+    logpost((t_object *)self, 3, "round: %d samples", (int)self->round_frames);
+    logpost((t_object *)self, 3, "engine: %d", self->patch.engine);
+    logpost((t_object *)self, 3, "drone: %d", self->drone);
+    logpost((t_object *)self, 3, "nan_resets: %ld", nan_resets);
+}
+
+void myObj_latency(t_myObj *self)
+{
+    t_atom argv;
+    SETFLOAT(&argv, static_cast<float>(self->vs));
+    outlet_anything(self->info_out, gensym("latency"), 1, &argv);
+}
+
+#pragma mark----- dsp -----
+
+// runs on a worker or, for the jobs left over, on the audio thread
+static void myObj_render_voice(void *context, int index)
+{
+    t_myObj *self = (t_myObj *)context;
+    t_voice &v = self->voices[index];
+    size_t frames = self->round_frames;
+    pdmi::RandomScope random(v.random_state);
+
+    for (size_t offset = 0; offset < frames; offset += kBlockSize)
+    {
+        v.modulations.trigger = v.trigger && offset == 0 ? 1.0 : 0.0;
+        v.voice.Render(v.patch, v.modulations, v.out + offset, v.aux + offset, kBlockSize);
+    }
+    if (!pdmi::is_finite(v.out, frames) || !pdmi::is_finite(v.aux, frames))
+    {
+        // NaN or Inf in the voice state: start it over
+        stmlib::BufferAllocator allocator(v.shared_buffer, kSharedBufferBytes);
+        v.voice.Init(&allocator);
+        std::fill(v.out, v.out + frames, 0.0);
+        std::fill(v.aux, v.aux + frames, 0.0);
+        v.nan_resets.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// adds the finished round to the fifo, each voice ramped to its new gain
+static void myObj_mix_round(t_myObj *self)
+{
+    size_t frames = self->round_frames;
+    for (int c = 0; c < 2; ++c)
+    {
+        t_sample *fifo = self->fifo[c];
+        std::copy(fifo + self->fifo_read, fifo + self->fifo_read + self->fifo_available, fifo);
+        std::fill(fifo + self->fifo_available, fifo + self->fifo_available + frames, 0);
+    }
+    self->fifo_read = 0;
+
+    t_sample *out = self->fifo[0] + self->fifo_available;
+    t_sample *aux = self->fifo[1] + self->fifo_available;
+    float step = 1.f / frames;
+    for (int i = 0; i < self->num_voices; ++i)
+    {
+        t_voice &v = self->voices[i];
+        if (v.gain == 0.f && v.previous_gain == 0.f)
+            continue;
+        float gain = v.previous_gain;
+        float increment = (v.gain - v.previous_gain) * step;
+        for (size_t n = 0; n < frames; ++n)
+        {
+            gain += increment;
+            out[n] += static_cast<t_sample>(v.out[n] * gain);
+            aux[n] += static_cast<t_sample>(v.aux[n] * gain);
+        }
+        v.previous_gain = v.gain;
+    }
+    self->fifo_available += frames;
+}
+
+// hands the next round to the pool; no voice is being rendered here
+static void myObj_launch_round(t_myObj *self)
+{
+    for (int i = 0; i < self->num_voices; ++i)
+    {
+        t_voice &v = self->voices[i];
+        v.patch = self->patch;
+        v.patch.note = v.note;
+        v.modulations.trigger_patched = !self->drone;
+        v.trigger = v.pending_trigger && !self->drone;
+        v.pending_trigger = false;
+        v.gain = v.velocity;
+        if (v.trigger)
+            v.previous_gain = v.gain; // a new note, no ramp from the last one
+        if (self->seed_pending)
+            v.random_state = self->seed + pdmi::instance_seed(i);
+    }
+    self->seed_pending = false;
+    self->pool->Launch();
+}
+
+static t_int *myObj_perform(t_int *w)
+{
+    t_myObj *self = (t_myObj *)(w[1]);
+    pdmi::ScopedFlushDenormals flush;
+    t_sample *out = (t_sample *)(w[2]);
+    t_sample *aux = (t_sample *)(w[3]);
+    int vs = (int)(w[4]); // sampleframes
+
+    if (!self->sr_ok)
+    {
+        std::fill(out, out + vs, 0);
+        std::fill(aux, aux + vs, 0);
+        return (w + 5);
+    }
+
+    // the round launched last tick, finished by now unless the workers
+    // didn't get a core
+    if (self->pool->launched())
+    {
+        self->pool->Finish();
+        myObj_mix_round(self);
+    }
+
+    std::copy(self->fifo[0] + self->fifo_read, self->fifo[0] + self->fifo_read + vs, out);
+    std::copy(self->fifo[1] + self->fifo_read, self->fifo[1] + self->fifo_read + vs, aux);
+    self->fifo_read += vs;
+    self->fifo_available -= vs;
+
+    // a round is at least a vector, so one more covers the next tick
+    if (self->fifo_available < (size_t)vs)
+        myObj_launch_round(self);
+    return (w + 5);
+}
+
+static void myObj_free_buffers(t_myObj *self)
+{
+    for (int i = 0; i < self->num_voices; ++i)
+    {
+        t_voice &v = self->voices[i];
+        if (v.out)
+            freebytes(v.out, self->round_frames * sizeof(double));
+        if (v.aux)
+            freebytes(v.aux, self->round_frames * sizeof(double));
+        v.out = v.aux = nullptr;
+    }
+    for (int c = 0; c < 2; ++c)
+    {
+        if (self->fifo[c])
+            freebytes(self->fifo[c], self->fifo_size * sizeof(t_sample));
+        self->fifo[c] = nullptr;
+    }
+}
+
+static void myObj_dsp(t_myObj *self, t_signal **sp)
+{
+    // Rounds from before DSP was switched off or the graph changed: all
+    // pools' rounds, so that no worker reads the rate while it changes.
+    // The audio thread isn't running any perform routine here.
+    for (t_myObj *pool = pools; pool; pool = pool->next_pool)
+        pool->pool->Finish();
+
+    if (sys_getsr() > 0 && sys_getsr() != kSampleRate)
+        setSr(sys_getsr());
+    self->sr = sp[0]->s_sr;
+    self->sr_ok = self->sr == kSampleRate;
+    if (!self->sr_ok)
+        pd_error((t_object *)self, "pd.mi.plts_pool~: %g Hz here, but all pools run at Pd's %g Hz, silent",
+                 self->sr, kSampleRate);
+
+    int vs = sp[0]->s_n;
+    size_t frames = (vs + kBlockSize - 1) / kBlockSize * kBlockSize;
+    if (vs != self->vs || frames != self->round_frames)
+    {
+        myObj_free_buffers(self);
+        self->vs = vs;
+        self->round_frames = frames;
+        self->fifo_size = frames + vs;
+        for (int i = 0; i < self->num_voices; ++i)
+        {
+            self->voices[i].out = (double *)getbytes(frames * sizeof(double));
+            self->voices[i].aux = (double *)getbytes(frames * sizeof(double));
+        }
+        for (int c = 0; c < 2; ++c)
+            self->fifo[c] = (t_sample *)getbytes(self->fifo_size * sizeof(t_sample));
+    }
+
+    // one vector of silence: the latency
+    for (int c = 0; c < 2; ++c)
+        std::fill(self->fifo[c], self->fifo[c] + self->fifo_size, 0);
+    self->fifo_read = 0;
+    self->fifo_available = vs;
+
+    dsp_add(myObj_perform, 4, self,
+            sp[0]->s_vec, // 2 outlets
+            sp[1]->s_vec,
+            sp[0]->s_n);
+}
+
+#pragma mark---- free function ----
+
+void myObj_free(t_myObj *self)
+{
+    self->pool->Stop();
+    delete self->pool;
+    for (t_myObj **link = &pools; *link; link = &(*link)->next_pool)
+    {
+        if (*link == self)
+        {
+            *link = self->next_pool;
+            break;
+        }
+    }
+
+    myObj_free_buffers(self);
+    for (int i = 0; i < self->num_voices; ++i)
+        freebytes(self->voices[i].shared_buffer, kSharedBufferBytes);
+    delete[] self->voices;
+
+    outlet_free(self->m_out);
+    outlet_free(self->m_aux);
+    outlet_free(self->info_out);
+}
+
+extern "C"
+{
+    extern void setup_pd0x2emi0x2eplts_pool_tilde(void)
+    {
+        this_class = class_new(gensym("pd.mi.plts_pool~"),
+                               (t_newmethod)myObj_new, (t_method)myObj_free,
+                               sizeof(t_myObj), CLASS_DEFAULT, A_GIMME, 0);
+        class_addcreator(
+            (t_newmethod)myObj_new,
+            gensym("mi/plts_pool~"),
+            A_GIMME, 0);
+        if (this_class)
+        {
+            class_addmethod(this_class, (t_method)myObj_dsp, gensym("dsp"), A_CANT, 0);
+
+            class_addmethod(this_class, (t_method)myObj_note, gensym("note"), A_GIMME, 0);
+            class_addmethod(this_class, (t_method)myObj_voice, gensym("voice"), A_GIMME, 0);
+            class_addmethod(this_class, (t_method)myObj_off, gensym("off"), A_NULL);
+            class_addmethod(this_class, (t_method)myObj_drone, gensym("drone"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_seed, gensym("seed"), A_FLOAT, 0);
+
+            class_addmethod(this_class, (t_method)myObj_engine, gensym("engine"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_harmonics, gensym("harmonics"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_timbre, gensym("timbre"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_morph, gensym("morph"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_decay, gensym("decay"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_lpg_colour, gensym("lpg_colour"), A_FLOAT, 0);
+
+            class_addmethod(this_class, (t_method)myObj_info, gensym("info"), A_NULL);
+            class_addmethod(this_class, (t_method)myObj_latency, gensym("latency"), A_NULL);
+
+            post("pd.mi.plts_pool~ by przemysław sanecki --> https://software-materialism.org");
+            post("a pool of mutable instruments' 'plaits' voices on worker threads");
+        }
+    }
+}
@@ -29,6 +29,11 @@
 
 #include "plaits/dsp/dsp.h"
 #include "plaits/dsp/voice.h"
+#include "block_adapter.h"
+#include "denormals.h"
+#include "perf_stats.h"
+#include "random_state.h"
+#include "trace.h"
 #ifdef __APPLE__
 #include "Accelerate/Accelerate.h"
 #endif
@@ -45,18 +50,28 @@ using std::clamp;
 using std::optional;
 
 const size_t kBlockSize = plaits::kBlockSize;
+const int kNumEngines = 16;
 
 double kSampleRate = 48000.0;
 // static const double kCorrectedSampleRate = 47872.34;
 double a0 = (440.0 / 8.0) / kSampleRate;
 
 static t_class *this_class = nullptr;
+static uint32_t instance_count = 0; // for the default seeds
+
+// perform timing, for the 'stats' message
+struct t_stats
+{
+    pdmi::PerfStats total;
+    pdmi::PerfStats engine[kNumEngines]; // by active engine
+};
 
 struct t_myObj
 {
     t_object m_obj; // pd object - always placed in first in the object's struct
 
     plaits::Voice *voice_;
+    pdmi::BlockAdapter<8, 2, kBlockSize> adapter;
     plaits::Modulations modulations;
     plaits::Patch patch;
     double transposition_;
@@ -68,6 +83,10 @@ struct t_myObj
     char *shared_buffer;
     size_t shared_buffer_bytes;
     t_outlet *info_out;
+    t_stats *stats; // null unless timing is on
+    long nan_resets;
+    uint32_t random_state; // this instance's stmlib::Random state
+    pdmi::TraceTrack trace;
 
     double sr;
     int sigvs;
@@ -119,22 +138,15 @@ static void *myObj_new(t_symbol *s, int argc, t_atom *argv)
         self->info_out = outlet_new((t_object *)self, &s_anything);
 
         self->sigvs = sys_getblksize();
-        
-        
-        if(self->sigvs < kBlockSize) {
-            pd_error((t_object*)self,
-                         "sigvs can't be smaller than %zu samples\n", kBlockSize);
-            delete self;
-            self = NULL;
-            return self;
-        }
+        self->adapter.Init();
 
         self->sr = sys_getsr();
         if (self->sr <= 0)
             self->sr = 44100.0;
         
         
-        setSr(self->sr);
+        if (kSampleRate != self->sr)
+            setSr(self->sr);
         
         // init some params
         self->transposition_ = 0.;
@@ -161,6 +173,10 @@ static void *myObj_new(t_symbol *s, int argc, t_atom *argv)
         self->voice_ = new plaits::Voice;
         self->voice_->Init(&allocator);
 
+        self->stats = nullptr;
+        self->nan_resets = 0;
+        self->random_state = pdmi::instance_seed(instance_count++);
+
         // attributes ====
         int argnum = 0;
         while (argc > 0)
@@ -193,6 +209,17 @@ static void *myObj_new(t_symbol *s, int argc, t_atom *argv)
                         argv += 2;
                     }
                 }
+                else if (strcmp(curarg->s_name, "@timing") == 0)
+                {
+                    if (argc >= 2)
+                    {
+                        t_float argval = atom_getfloatarg(1, argc, argv);
+                        if (argval != 0.f && !self->stats)
+                            self->stats = new t_stats;
+                        argc -= 2;
+                        argv += 2;
+                    }
+                }
                 else
                 {
                     argc -= 2;
@@ -402,88 +429,198 @@ void myObj_note(t_myObj *self, t_floatarg n)
     self->patch.note = n;
 }
 
+void myObj_seed(t_myObj *self, t_floatarg s)
+{
+    self->random_state = pdmi::seed_state(s);
+}
+
 // ---------------------------------------------------- //
 
-static t_int *myObj_perform(t_int *w)
+// renders one block of kBlockSize samples
+static void myObj_render_block(t_myObj *self, t_sample *const *ins, t_sample *const *outs)
 {
-    t_myObj *self = (t_myObj *)(w[1]);
     // 8 audio inputs, 2 outputs
-    t_sample *trig_input = (t_sample *)(w[8]);
-    t_sample *out = (t_sample *)(w[10]);
-    t_sample *aux = (t_sample *)(w[11]);
+    t_sample *trig_input = ins[6];
+    t_sample *out = outs[0];
+    t_sample *aux = outs[1];
 
-    int vs = (int)(w[12]); // sampleframes
     size_t size = kBlockSize;
     double *out_tmp = self->out_tmp;
     double *aux_tmp = self->aux_tmp;
 
-    // double  pitch_lp_ = 0.; //self->pitch_lp_;
-    size_t count = 0;
-
-    int ins = 2;
-
     double *destination = &self->modulations.engine;
 
-    for (count = 0; count < vs; count += size)
+    for (int i = 0; i < 8; i++)
     {
+        destination[i] = ins[i][0];
+    }
 
-        for (int i = 0; i < 8; i++)
-        {
-            t_sample *in = (t_sample *)(w[ins + i]);
-            destination[i] = in[count];
-        }
-
-        if (self->modulations.trigger_patched)
-        {
-            // calc sum of trigger input
-            t_sample vectorsum = 0.0;
+    if (self->modulations.trigger_patched)
+    {
+        // calc sum of trigger input
+        t_sample vectorsum = 0.0;
 #ifdef __APPLE__
 #if PD_FLOATSIZE == 32
-            vDSP_sve(trig_input + count, 1, &vectorsum, size);
+        vDSP_sve(trig_input, 1, &vectorsum, size);
 #elif PD_FLOATSIZE == 64
-            vDSP_sveD(trig_input + count, 1, &vectorsum, size);
+        vDSP_sveD(trig_input, 1, &vectorsum, size);
 #else // PD_FLOATSIZE
 #error Unexpected PD_FLOATSIZE
 #endif // PD_FLOATSIZE
 #else
-            for (int i = 0; i < size; ++i)
-                vectorsum += trig_input[i + count];
+        for (int i = 0; i < size; ++i)
+            vectorsum += trig_input[i];
 #endif
-            self->modulations.trigger = vectorsum;
-        }
-        // smooth out pitch changes
-        // ONE_POLE(pitch_lp_, self->modulations.note, 0.7);
+        self->modulations.trigger = vectorsum;
+    }
+    // smooth out pitch changes
+    // ONE_POLE(pitch_lp_, self->modulations.note, 0.7);
 
-        // self->modulations.note = pitch_lp_;
+    // self->modulations.note = pitch_lp_;
 
-        self->voice_->Render(self->patch, self->modulations, out_tmp, aux_tmp, size);
-        std::copy(out_tmp, out_tmp + size, out + count);
-        std::copy(aux_tmp, aux_tmp + size, aux + count);
+    self->voice_->Render(self->patch, self->modulations, out_tmp, aux_tmp, size);
+    if (!pdmi::is_finite(out_tmp, size) || !pdmi::is_finite(aux_tmp, size))
+    {
+        // NaN or Inf in the voice state: start it over with the same patch
+        stmlib::BufferAllocator allocator(self->shared_buffer, self->shared_buffer_bytes);
+        self->voice_->Init(&allocator);
+        std::fill(out_tmp, out_tmp + size, 0.0);
+        std::fill(aux_tmp, aux_tmp + size, 0.0);
+        self->nan_resets++;
+        self->trace.Instant(self, "nan_reset", self->patch.engine);
     }
+    std::copy(out_tmp, out_tmp + size, out);
+    std::copy(aux_tmp, aux_tmp + size, aux);
+}
+
+static t_int *myObj_perform(t_int *w)
+{
+    t_myObj *self = (t_myObj *)(w[1]);
+    pdmi::ScopedFlushDenormals flush;
+    t_sample **ins = (t_sample **)(w + 2);  // 8 inlets
+    t_sample **outs = (t_sample **)(w + 10); // 2 outlets
+    int vs = (int)(w[12]); // sampleframes
+    uint64_t trace_begin = self->trace.Begin();
 
+    pdmi::RandomScope random(self->random_state);
+
+    self->adapter.Process(ins, outs, vs, [self](t_sample *const *block_in, t_sample *const *block_out, int) {
+        myObj_render_block(self, block_in, block_out);
+    });
+
+    self->trace.Change(self, "engine", self->voice_->active_engine());
+    self->trace.EndPerform(self, trace_begin);
     return (w + 13);
 }
 
-static void myObj_dsp(t_myObj *self, t_signal **sp)
+static t_int *myObj_perform_timed(t_int *w)
 {
+    t_myObj *self = (t_myObj *)(w[1]);
+    uint64_t start = pdmi::perf_ticks();
+    t_int *next = myObj_perform(w);
+    uint64_t ticks = pdmi::perf_ticks() - start;
 
-    // self->trigger_connected = 0;
-    // self->modulations.trigger_patched = self->trigger_toggle && self->trigger_connected;
+    t_stats *stats = self->stats;
+    if (stats)
+    {
+        int vs = (int)(w[12]);
+        stats->total.Add(ticks, vs);
+        int engine = self->voice_->active_engine();
+        if (engine >= 0 && engine < kNumEngines)
+            stats->engine[engine].Add(ticks, vs);
+    }
+    return next;
+}
+
+void myObj_latency(t_myObj *self)
+{
+    t_atom argv;
+    SETFLOAT(&argv, static_cast<float>(self->adapter.latency()));
+    outlet_anything(self->info_out, gensym("latency"), 1, &argv);
+}
+
+#pragma mark----- timing -----
 
-    if (sys_getblksize() < kBlockSize)
+void myObj_timing(t_myObj *self, t_floatarg t)
+{
+    bool on = t != 0.f;
+    if (on == (self->stats != nullptr))
+        return;
+    if (on)
+        self->stats = new t_stats;
+    else
     {
-        pd_error((t_object *)self, "sigvs can't be smaller than %zu samples, sorry!", kBlockSize);
+        delete self->stats;
+        self->stats = nullptr;
+    }
+    // swap the perform routine
+    canvas_update_dsp();
+}
+
+// 'stats count mean p50 p99 max load%' for the whole object, then one
+// 'stats_engine <engine> count ...' per engine that has rendered since the
+// last reset; times are ns per block
+void myObj_stats(t_myObj *self)
+{
+    t_atom resets;
+    SETFLOAT(&resets, static_cast<float>(self->nan_resets));
+    outlet_anything(self->info_out, gensym("nan_resets"), 1, &resets);
+
+    if (!self->stats)
+    {
+        post("pd.mi.plts~: timing is off, send 'timing 1' first");
         return;
     }
+    t_atom argv[7];
+    int argc = pdmi::perf_atoms(self->stats->total.Summarize(self->sr), argv);
+    outlet_anything(self->info_out, gensym("stats"), argc, argv);
 
-    if (sys_getsr() != self->sr)
+    for (int i = 0; i < kNumEngines; ++i)
     {
-        self->sr = sys_getsr();
-        kSampleRate = self->sr;
-        a0 = (440.0f / 8.0f) / kSampleRate;
+        const pdmi::PerfStats &engine = self->stats->engine[i];
+        if (!engine.count())
+            continue;
+        SETFLOAT(argv, static_cast<float>(i));
+        argc = 1 + pdmi::perf_atoms(engine.Summarize(self->sr), argv + 1);
+        outlet_anything(self->info_out, gensym("stats_engine"), argc, argv);
     }
+}
 
-    dsp_add(myObj_perform, 12 /* x+inlets+outlets+s_n */,
+void myObj_stats_reset(t_myObj *self)
+{
+    self->nan_resets = 0;
+    if (!self->stats)
+        return;
+    self->stats->total.Reset();
+    for (int i = 0; i < kNumEngines; ++i)
+        self->stats->engine[i].Reset();
+}
+
+void myObj_trace_dump(t_myObj *self, t_symbol *file)
+{
+    pdmi::trace_dump((t_object *)self, "pd.mi.plts~", file);
+}
+
+static void myObj_dsp(t_myObj *self, t_signal **sp)
+{
+
+    // self->trigger_connected = 0;
+    // self->modulations.trigger_patched = self->trigger_toggle && self->trigger_connected;
+
+    // the plaits code reads the sample rate from globals, shared by every
+    // plts~ and plts_pool~ (whose workers read them during perform), so
+    // they are only written here and hold Pd's rate. An object in a
+    // resampled subpatch still renders at that rate.
+    if (sys_getsr() > 0 && sys_getsr() != kSampleRate)
+        setSr(sys_getsr());
+    self->sr = sp[0]->s_sr;
+    if (self->sr != kSampleRate)
+        pd_error((t_object *)self, "pd.mi.plts~: %g Hz here, but plaits runs at Pd's %g Hz, out of tune",
+                 self->sr, kSampleRate);
+
+    self->adapter.Configure(sp[0]->s_n);
+
+    dsp_add(self->stats ? myObj_perform_timed : myObj_perform, 12 /* x+inlets+outlets+s_n */,
             self,
             sp[0]->s_vec, // 8 inlets
             sp[1]->s_vec,
@@ -518,6 +655,8 @@ void myObj_free(t_myObj *self)
     outlet_free(self->info_out);
     // delete self->modulator;
 
+    delete self->stats;
+
     if (self->shared_buffer)
         freebytes(self->shared_buffer, self->shared_buffer_bytes);
 
@@ -559,16 +698,25 @@ extern "C"
             class_addmethod(this_class, (t_method)myObj_decay, gensym("decay"), A_FLOAT, 0);
 
             class_addmethod(this_class, (t_method)myObj_note, gensym("note"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_seed, gensym("seed"), A_FLOAT, 0);
 
             class_addmethod(this_class, (t_method)myObj_choose_engine, gensym("engine"), A_FLOAT, 0);
             class_addmethod(this_class, (t_method)myObj_get_engine, gensym("get_engine"), A_DEFSYMBOL, 0);
             class_addmethod(this_class, (t_method)myObj_plug, gensym("plug"), A_GIMME, 0);
             // class_addmethod(this_class, (t_method)myObj_float, gensym("float"), A_FLOAT, 0);
             class_addmethod(this_class, (t_method)myObj_info, gensym("info"), A_DEFSYMBOL, 0);
-
+            class_addmethod(this_class, (t_method)myObj_latency, gensym("latency"), A_NULL);
+            class_addmethod(this_class, (t_method)myObj_timing, gensym("timing"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_stats, gensym("stats"), A_NULL);
+            class_addmethod(this_class, (t_method)myObj_stats_reset, gensym("stats_reset"), A_NULL);
+            class_addmethod(this_class, (t_method)myObj_trace_dump, gensym("trace_dump"), A_DEFSYMBOL, 0);
+            pdmi::trace_setup();
+
+#ifndef PD_MI_LIBRARY // the library posts one banner for all
             post("vb.mi.plts~ by volker böhm --> https://vboehm.net");
             post("rewritten for Pd as pd.mi.plts~ by przemysław sanecki --> https://software-materialism.org");
             post("a clone of mutable instruments' 'plaits' module");
+#endif
         }
     }
 }
@@ -30,7 +30,15 @@
 
 #include "tides2/poly_slope_generator.h"
 #include "tides2/ramp_extractor.h"
+#include "stmlib/dsp/units.h"
 
+#include "block_adapter.h"
+#include "denormals.h"
+#include "perf_stats.h"
+#include "random_state.h"
+#include "trace.h"
+
+#include <cmath>
 #include <cstring>
 #include <algorithm>
 #include <cstdlib>
@@ -39,10 +47,50 @@
 using std::clamp;
 using std::optional;
 
-const size_t kAudioBlockSize = 8; // sig vs can't be smaller than this!
+const size_t kAudioBlockSize = 8; // smaller Pd vectors go through the block adapter
 const size_t kNumOutputs = 4;
+const size_t kCycleTableSize = 2048; // longest cached period in samples, plus one guard point
+const size_t kCycleBuildStep = 32;   // table points rendered per block while building
+const float kSettleThreshold = 1e-4f;
 
 static t_class *this_class = nullptr;
+static uint32_t instance_count = 0; // for the default seeds
+
+// how the frequency inlet and the freq knob combine
+enum FreqMode
+{
+    FREQ_MODE_LINEAR,       // Hz, sampled once per block
+    FREQ_MODE_EXPONENTIAL,  // freq knob (Hz) * 2^inlet, i.e. 1.0 per octave
+    FREQ_MODE_THROUGH_ZERO, // Hz, may go negative
+    FREQ_MODE_LAST
+};
+
+// A clock bus lets several tds~ share one RampExtractor. The first subscriber
+// to run in a DSP tick analyses its clock input at a 1:1 ratio, the others
+// reuse the published ramp and apply their own ratio on top of it.
+struct t_clock_bus
+{
+    t_symbol *name;
+    int refcount;
+    tides::RampExtractor ramp_extractor;
+    stmlib::GateFlags previous_flag;
+    double stamp;     // logical time of the last analysed tick
+    double dsp_stamp; // logical time of the last dsp chain build
+    long vs;
+    long capacity;
+    float *ramp;      // 1:1 ramp, one value per sample
+    float *frequency; // one value per kAudioBlockSize samples
+    t_clock_bus *next;
+};
+
+static t_clock_bus *clock_buses = nullptr;
+
+// follows a 1:1 master ramp at an arbitrary ratio
+struct t_ratio_follower
+{
+    float previous_phase;
+    int cycle; // master cycles elapsed, modulo ratio.q
+};
 
 struct t_myObj
 {
@@ -50,6 +98,7 @@ struct t_myObj
 
     tides::PolySlopeGenerator poly_slope_generator;
     tides::RampExtractor ramp_extractor;
+    pdmi::BlockAdapter<7, kNumOutputs, kAudioBlockSize> adapter;
 
     tides::PolySlopeGenerator::OutputSample out[kAudioBlockSize];
     stmlib::GateFlags no_gate[kAudioBlockSize];
@@ -60,6 +109,28 @@ struct t_myObj
 
     float ramp[kAudioBlockSize];
 
+    t_clock_bus *clock_bus;
+    t_ratio_follower follower;
+
+    // cycle cache for free running loops with static parameters
+    bool cycle_cache;
+    bool cache_valid;
+    bool cache_building;
+    size_t cache_build_position; // generator samples rendered, 0..2 * cache_period
+    size_t cache_period;         // table points, one per sample of the period
+    float loop_phase;
+    bool loop_owned; // the live generator follows loop_phase, not its own phase
+    float *cache_table; // kNumOutputs * (kCycleTableSize + 1)
+    tides::PolySlopeGenerator *cache_generator;
+    pdmi::PerfStats *stats; // perform timing, null unless on
+    long nan_resets;
+    uint32_t random_state; // this instance's stmlib::Random state
+    pdmi::TraceTrack trace;
+    float cache_frequency, cache_shape, cache_slope, cache_smooth, cache_shift;
+    tides::OutputMode cache_output_mode;
+    tides::Range cache_range;
+
+    FreqMode freq_mode;
     tides::OutputMode output_mode;
     tides::OutputMode previous_output_mode;
     tides::RampMode ramp_mode;
@@ -76,6 +147,7 @@ struct t_myObj
     bool clock_connected;
     bool use_trigger;
     bool use_clock;
+    bool use_phase;
 
     float sr;
     float r_sr;
@@ -123,6 +195,272 @@ static tides::Ratio kRatios[19] = {
     {16.0f, 1},
 };
 
+#pragma mark-------- clock bus ----------
+
+static t_clock_bus *clock_bus_acquire(t_symbol *name, float sr)
+{
+    for (t_clock_bus *bus = clock_buses; bus; bus = bus->next)
+    {
+        if (bus->name == name)
+        {
+            bus->refcount++;
+            return bus;
+        }
+    }
+
+    t_clock_bus *bus = new t_clock_bus;
+    bus->name = name;
+    bus->refcount = 1;
+    bus->ramp_extractor.Init(sr, 40.0f / sr);
+    bus->previous_flag = stmlib::GATE_FLAG_LOW;
+    bus->stamp = -1.;
+    bus->dsp_stamp = -1.;
+    bus->vs = 0;
+    bus->capacity = 0;
+    bus->ramp = nullptr;
+    bus->frequency = nullptr;
+    bus->next = clock_buses;
+    clock_buses = bus;
+    return bus;
+}
+
+static void clock_bus_release(t_clock_bus *bus)
+{
+    if (--bus->refcount > 0)
+        return;
+
+    for (t_clock_bus **link = &clock_buses; *link; link = &(*link)->next)
+    {
+        if (*link == bus)
+        {
+            *link = bus->next;
+            break;
+        }
+    }
+    if (bus->ramp)
+        freebytes(bus->ramp, bus->capacity * sizeof(float));
+    if (bus->frequency)
+        freebytes(bus->frequency, bus->capacity / kAudioBlockSize * sizeof(float));
+    delete bus;
+}
+
+// called from the dsp method, before any perform routine runs.
+// All subscribers of a bus have to run at the same block size.
+static bool clock_bus_prepare(t_clock_bus *bus, long vs, float sr)
+{
+    double now = clock_getlogicaltime();
+    if (bus->dsp_stamp == now && bus->vs != vs)
+        return false;
+    bus->dsp_stamp = now;
+
+    if (bus->capacity < vs)
+    {
+        if (bus->ramp)
+            freebytes(bus->ramp, bus->capacity * sizeof(float));
+        if (bus->frequency)
+            freebytes(bus->frequency, bus->capacity / kAudioBlockSize * sizeof(float));
+        bus->capacity = vs;
+        bus->ramp = (float *)getbytes(vs * sizeof(float));
+        bus->frequency = (float *)getbytes(vs / kAudioBlockSize * sizeof(float));
+    }
+    bus->ramp_extractor.Init(sr, 40.0f / sr);
+    bus->stamp = -1.;
+    bus->vs = vs;
+    return true;
+}
+
+// analyses the clock once per tick, whichever subscriber gets here first
+static void clock_bus_process(t_clock_bus *bus, const t_sample *clock_in, long vs,
+                              tides::Range range, bool alternate, float sr)
+{
+    double now = clock_getlogicaltime();
+    if (now == bus->stamp)
+        return;
+
+    // more than one tick without analysis: the period history is stale
+    if (bus->stamp < 0. || clock_gettimesince(bus->stamp) > 2000. * vs / sr)
+        bus->ramp_extractor.Reset();
+    bus->stamp = now;
+
+    const tides::Ratio unity = {1.0f, 1};
+    stmlib::GateFlags clock_input[kAudioBlockSize];
+
+    for (long count = 0; count < vs; count += kAudioBlockSize)
+    {
+        for (size_t i = 0; i < kAudioBlockSize; ++i)
+        {
+            bool trig = clock_in[i + count] > 0.01;
+            bus->previous_flag = stmlib::ExtractGateFlags(bus->previous_flag, trig);
+            clock_input[i] = bus->previous_flag;
+        }
+        bus->frequency[count / kAudioBlockSize] = bus->ramp_extractor.Process(range, alternate, unity,
+                                                                              clock_input,
+                                                                              bus->ramp + count,
+                                                                              kAudioBlockSize);
+    }
+}
+
+// Scales a 1:1 master ramp by ratio.ratio. Master cycles are counted modulo
+// ratio.q, so every follower restarts in phase with the master after q cycles.
+static void ratio_follow(t_ratio_follower *follower, const tides::Ratio &ratio,
+                         const float *in, float *out, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        float phase = in[i];
+        if (phase < follower->previous_phase - 0.5f)
+        {
+            if (++follower->cycle >= ratio.q)
+                follower->cycle = 0;
+        }
+        else if (phase > follower->previous_phase + 0.5f)
+        {
+            if (--follower->cycle < 0)
+                follower->cycle = ratio.q - 1;
+        }
+        follower->previous_phase = phase;
+
+        float scaled = (static_cast<float>(follower->cycle) + phase) * ratio.ratio;
+        out[i] = scaled - static_cast<float>(static_cast<int>(scaled));
+    }
+}
+
+// wraps an external phase signal (e.g. a phasor~) into [0, 1) and returns
+// its average increment per sample, i.e. the master frequency
+static float phase_input(t_ratio_follower *follower, const t_sample *phase_in,
+                         float *out, size_t size)
+{
+    float previous = follower->previous_phase;
+    float increment = 0.f;
+    for (size_t i = 0; i < size; ++i)
+    {
+        float phase = phase_in[i];
+        phase -= floorf(phase);
+        float delta = phase - previous;
+        if (delta < -0.5f)
+            delta += 1.f;
+        else if (delta >= 0.5f)
+            delta -= 1.f;
+        increment += delta;
+        previous = phase;
+        out[i] = phase;
+    }
+    return increment / static_cast<float>(size);
+}
+
+void myObj_clock_bus(t_myObj *self, t_symbol *name)
+{
+    if (self->clock_bus)
+    {
+        clock_bus_release(self->clock_bus);
+        self->clock_bus = nullptr;
+    }
+    if (name && *name->s_name)
+    {
+        self->clock_bus = clock_bus_acquire(name, self->sr);
+        self->follower.previous_phase = 0.f;
+        self->follower.cycle = 0;
+    }
+    canvas_update_dsp();
+}
+
+#pragma mark-------- cycle cache ----------
+
+void myObj_cycle_cache(t_myObj *self, t_float m)
+{
+    self->cycle_cache = (int)m != 0;
+    self->cache_valid = false;
+    self->cache_building = false;
+    if (self->cycle_cache && !self->cache_table)
+    {
+        self->cache_table = (float *)getbytes(kNumOutputs * (kCycleTableSize + 1) * sizeof(float));
+        self->cache_generator = new tides::PolySlopeGenerator;
+        self->cache_generator->Init();
+    }
+    verbose(3, "cycle cache %i", self->cycle_cache);
+}
+
+// Renders one period of the cached waveform (the cache_* parameters) into
+// the cache table, kCycleBuildStep points per call so that no perform call
+// pays for the whole table; the live generator keeps playing meanwhile. The
+// cache generator runs at the cached increment, one table point per sample
+// at phases 0, f, 2f.. below 1, two periods in a row so the filters have
+// settled when the second one gets recorded. Returns true once the table
+// is complete.
+static bool cycle_cache_build(t_myObj *self)
+{
+    tides::PolySlopeGenerator::OutputSample out[kAudioBlockSize];
+    float ramp[kAudioBlockSize];
+    const float frequency = self->cache_frequency;
+    const size_t period = self->cache_period;
+
+    if (self->cache_build_position == 0)
+        self->cache_generator->Reset();
+
+    size_t end = std::min(self->cache_build_position + kCycleBuildStep, 2 * period);
+    for (size_t position = self->cache_build_position; position < end;)
+    {
+        // blocks don't cross the end of a period, where the ramp restarts
+        size_t n = position % period;
+        size_t size = std::min(kAudioBlockSize, period - n);
+        for (size_t i = 0; i < size; ++i)
+            ramp[i] = static_cast<float>(n + i) * frequency;
+
+        self->cache_generator->Render(tides::RAMP_MODE_LOOPING, self->cache_output_mode, self->cache_range,
+                                      frequency, self->cache_slope, self->cache_shape, self->cache_smooth,
+                                      self->cache_shift, self->no_gate, ramp, out, size);
+        if (position >= period)
+        {
+            for (size_t j = 0; j < kNumOutputs; ++j)
+            {
+                float *table = self->cache_table + j * (kCycleTableSize + 1);
+                for (size_t i = 0; i < size; ++i)
+                    table[n + i] = out[i].channel[j] * 0.1f;
+            }
+        }
+        position += size;
+    }
+    self->cache_build_position = end;
+    if (end < 2 * period)
+        return false;
+
+    for (size_t j = 0; j < kNumOutputs; ++j)
+    {
+        float *table = self->cache_table + j * (kCycleTableSize + 1);
+        table[period] = table[0];
+    }
+    return true;
+}
+
+// point n of the table is at phase n * frequency; the last point is
+// followed by the shorter step to phase 1, i.e. point 0 again
+static void cycle_cache_play(t_myObj *self, float frequency, t_sample *const *outs)
+{
+    const size_t last = self->cache_period - 1;
+    const float last_phase = static_cast<float>(last) * frequency;
+    const float inverse = 1.f / frequency;
+    const float last_inverse = 1.f / (1.f - last_phase);
+
+    float phase = self->loop_phase;
+    for (size_t i = 0; i < kAudioBlockSize; ++i)
+    {
+        phase += frequency;
+        if (phase >= 1.f)
+            phase -= 1.f;
+
+        float index = phase * inverse;
+        size_t integral = std::min(static_cast<size_t>(index), last);
+        float fractional = integral == last ? (phase - last_phase) * last_inverse
+                                            : index - static_cast<float>(integral);
+        for (size_t j = 0; j < kNumOutputs; ++j)
+        {
+            const float *table = self->cache_table + j * (kCycleTableSize + 1) + integral;
+            outs[j][i] = table[0] + (table[1] - table[0]) * fractional;
+        }
+    }
+    self->loop_phase = phase;
+}
+
 void *myObj_new(t_symbol *s, int argc, t_atom *argv)
 {
     t_myObj *self = (t_myObj *)pd_new(this_class);
@@ -144,25 +482,18 @@ void *myObj_new(t_symbol *s, int argc, t_atom *argv)
 
         self->sigvs = sys_getblksize();
 
-        if (self->sigvs < kAudioBlockSize)
-        {
-            pd_error((t_object *)self,
-                     "sigvs can't be smaller than %zu samples\n", kAudioBlockSize);
-            delete self;
-            self = NULL;
-            return self;
-        }
-
         self->sr = sys_getsr();
         self->r_sr = 1.f / self->sr;
 
         self->poly_slope_generator.Init();
         self->ramp_extractor.Init(self->sr, 40.0f * self->r_sr);
+        self->adapter.Init();
 
         std::fill(&self->no_gate[0], &self->no_gate[kAudioBlockSize], stmlib::GATE_FLAG_LOW);
         std::fill(&self->clock_input[0], &self->clock_input[kAudioBlockSize], stmlib::GATE_FLAG_LOW);
         std::fill(&self->ramp[0], &self->ramp[kAudioBlockSize], 0.f);
 
+        self->freq_mode = FREQ_MODE_LINEAR;
         self->output_mode = tides::OUTPUT_MODE_GATES;
         self->previous_output_mode = tides::OUTPUT_MODE_GATES;
         self->ramp_mode = tides::RAMP_MODE_LOOPING;
@@ -173,6 +504,7 @@ void *myObj_new(t_symbol *s, int argc, t_atom *argv)
 
         self->use_trigger = false;
         self->use_clock = false;
+        self->use_phase = false;
         self->must_reset_ramp_extractor = false;
 
         self->frequency = 1.f;
@@ -186,6 +518,23 @@ void *myObj_new(t_symbol *s, int argc, t_atom *argv)
         self->r_.ratio = 1.0f;
         self->r_.q = 1;
 
+        self->clock_bus = nullptr;
+        self->follower.previous_phase = 0.f;
+        self->follower.cycle = 0;
+
+        self->cycle_cache = false;
+        self->cache_valid = false;
+        self->cache_building = false;
+        self->cache_build_position = 0;
+        self->cache_period = 0;
+        self->loop_phase = 0.f;
+        self->loop_owned = false;
+        self->cache_table = nullptr;
+        self->cache_generator = nullptr;
+        self->stats = nullptr;
+        self->nan_resets = 0;
+        self->random_state = pdmi::instance_seed(instance_count++);
+
         // process attributes
         // attr_args_process(self, argc, argv);
         int argnum = 0;
@@ -205,6 +554,17 @@ void *myObj_new(t_symbol *s, int argc, t_atom *argv)
                         argv += 2;
                     }
                 }
+                else if (strcmp(curarg->s_name, "@freq_mode") == 0)
+                {
+                    if (argc >= 2)
+                    {
+                        t_float argval = atom_getfloatarg(1, argc, argv);
+                        long _m = clamp((int)argval, 0, FREQ_MODE_LAST - 1);
+                        self->freq_mode = FreqMode(_m);
+                        argc -= 2;
+                        argv += 2;
+                    }
+                }
                 else if (strcmp(curarg->s_name, "@ramp_mode") == 0)
                 {
                     if (argc >= 2)
@@ -249,6 +609,48 @@ void *myObj_new(t_symbol *s, int argc, t_atom *argv)
                         argv += 2;
                     }
                 }
+                else if (strcmp(curarg->s_name, "@use_phase") == 0)
+                {
+                    if (argc >= 2)
+                    {
+                        t_float argval = atom_getfloatarg(1, argc, argv);
+                        self->use_phase = (int)argval != 0;
+                        argc -= 2;
+                        argv += 2;
+                    }
+                }
+                else if (strcmp(curarg->s_name, "@cycle_cache") == 0)
+                {
+                    if (argc >= 2)
+                    {
+                        t_float argval = atom_getfloatarg(1, argc, argv);
+                        myObj_cycle_cache(self, argval);
+                        argc -= 2;
+                        argv += 2;
+                    }
+                }
+                else if (strcmp(curarg->s_name, "@timing") == 0)
+                {
+                    if (argc >= 2)
+                    {
+                        t_float argval = atom_getfloatarg(1, argc, argv);
+                        if (argval != 0.f && !self->stats)
+                            self->stats = new pdmi::PerfStats;
+                        argc -= 2;
+                        argv += 2;
+                    }
+                }
+                else if (strcmp(curarg->s_name, "@clock_bus") == 0)
+                {
+                    if (argc >= 2)
+                    {
+                        t_symbol *bus = atom_getsymbolarg(1, argc, argv);
+                        if (*bus->s_name)
+                            self->clock_bus = clock_bus_acquire(bus, self->sr);
+                        argc -= 2;
+                        argv += 2;
+                    }
+                }
                 else
                 {
                     argc -= 2;
@@ -333,6 +735,15 @@ void myObj_shift(t_myObj *self, t_float m)
     self->shift = m;
 }
 
+void myObj_use_phase(t_myObj *self, t_float m)
+{
+    // the clock inlet takes a 0..1 phase signal instead of clock pulses
+    self->use_phase = (int)m != 0;
+    self->follower.previous_phase = 0.f;
+    self->follower.cycle = 0;
+    verbose(3, "use phase %i", self->use_phase);
+}
+
 void myObj_ratio(t_myObj *self, t_float m)
 {
     CONSTRAIN(m, 0, 18);
@@ -340,6 +751,11 @@ void myObj_ratio(t_myObj *self, t_float m)
     //    post((t_object*)self, "ratio[%d]: ratio: %f -- q: %d", m, self->r_.ratio, self->r_.q);
 }
 
+void myObj_seed(t_myObj *self, t_float s)
+{
+    self->random_state = pdmi::seed_state(s);
+}
+
 void output_mode_setter(t_myObj *self, t_float m)
 {
     long _m = clamp((int)m, 0, 3);
@@ -348,10 +764,18 @@ void output_mode_setter(t_myObj *self, t_float m)
     if (self->output_mode != self->previous_output_mode)
     {
         self->poly_slope_generator.Reset();
+        self->trace.Instant(self, "PolySlopeGenerator::Reset", (int)_m);
         self->previous_output_mode = self->output_mode;
     }
 }
 
+void freq_mode_setter(t_myObj *self, t_float m)
+{
+    long _m = clamp((int)m, 0, FREQ_MODE_LAST - 1);
+    verbose(3, "freq mode %ld", _m);
+    self->freq_mode = FreqMode(_m);
+}
+
 void ramp_mode_setter(t_myObj *self, t_float m)
 {
     long _m = clamp((int)m, 0, 2);
@@ -373,21 +797,70 @@ void range_setter(t_myObj *self, t_float m)
 
 #pragma mark-------- DSP Loop ----------
 
-static t_int *myObj_perform(t_int *w)
+// Per-sample phase increments of the free running oscillator. Returns the
+// block's average absolute frequency, which is what Render() gets to see.
+static float block_frequency(t_myObj *self, const t_sample *freq_in, float *increment, bool *steady)
 {
-    t_myObj *self = (t_myObj *)(w[1]);
-    // 7 audio inputs, 4 outputs
+    float freq_knob = self->frequency;
+    float r_sr = self->r_sr;
+    float sum = 0.f;
 
-    t_sample *freq_in = (t_sample *)w[2];
-    t_sample *shape_in = (t_sample *)w[3];
-    t_sample *slope_in = (t_sample *)w[4];
-    t_sample *smooth_in = (t_sample *)w[5];
-    t_sample *shift_in = (t_sample *)w[6];
+    switch (self->freq_mode)
+    {
+    case FREQ_MODE_EXPONENTIAL:
+        for (size_t i = 0; i < kAudioBlockSize; ++i)
+        {
+            float semitones = freq_in[i] * 12.f;
+            CONSTRAIN(semitones, -128.f, 127.f);
+            float f = freq_knob * stmlib::SemitonesToRatio(semitones) * r_sr;
+            CONSTRAIN(f, 0.f, 0.4f);
+            increment[i] = f;
+            sum += f;
+        }
+        break;
 
-    t_sample *trig_in = (t_sample *)w[7];  // trigger signal input
-    t_sample *clock_in = (t_sample *)w[8]; // clock signal input
+    case FREQ_MODE_THROUGH_ZERO:
+        for (size_t i = 0; i < kAudioBlockSize; ++i)
+        {
+            float f = (freq_in[i] + freq_knob) * r_sr;
+            CONSTRAIN(f, -0.4f, 0.4f);
+            increment[i] = f;
+            sum += fabsf(f);
+        }
+        break;
 
-    int vs = (int)(w[13]); // sampleframes
+    default:
+    {
+        float f = (freq_in[0] + freq_knob) * r_sr;
+        CONSTRAIN(f, 0.f, 0.4f);
+        // no filtering for now
+        //            ONE_POLE(freq_lp, frequency, 0.3f);
+        //            frequency = freq_lp;
+        std::fill(&increment[0], &increment[kAudioBlockSize], f);
+        *steady = true;
+        return f;
+    }
+    }
+
+    *steady = std::all_of(&increment[1], &increment[kAudioBlockSize],
+                          [increment](float f) { return f == increment[0]; });
+    return sum / kAudioBlockSize;
+}
+
+// renders one block of kAudioBlockSize samples; bus_ramp/bus_frequency carry
+// the clock bus analysis for this block, if any
+static void myObj_render_block(t_myObj *self, t_sample *const *ins, t_sample *const *outs,
+                               const float *bus_ramp, float bus_frequency)
+{
+    // 7 audio inputs, 4 outputs
+    t_sample *freq_in = ins[0];
+    t_sample *shape_in = ins[1];
+    t_sample *slope_in = ins[2];
+    t_sample *smooth_in = ins[3];
+    t_sample *shift_in = ins[4];
+
+    t_sample *trig_in = ins[5];  // trigger signal input
+    t_sample *clock_in = ins[6]; // clock signal input
 
     tides::RampExtractor *ramp_extractor = &self->ramp_extractor;
     tides::PolySlopeGenerator::OutputSample *out = self->out;
@@ -397,9 +870,9 @@ static t_int *myObj_perform(t_int *w)
     stmlib::GateFlags *gate_flags = self->no_gate;
     stmlib::GateFlags *previous_flags = self->previous_flags_;
 
-    bool must_reset_ramp_extractor = self->must_reset_ramp_extractor;
     bool use_clock = self->use_clock;
     bool use_trigger = self->use_trigger;
+    bool use_phase = self->use_phase;
     bool clock_connected = self->clock_connected;
     bool trig_connected = self->trig_connected;
 
@@ -408,128 +881,312 @@ static t_int *myObj_perform(t_int *w)
     tides::Range range = self->range;
 
     float frequency, shape, slope, shift, smoothness;
-    float freq_knob = self->frequency;
-    float shape_knob = self->shape;
-    float slope_knob = self->slope;
-    float shift_knob = self->shift;
-    float smoothness_knob = self->smoothness;
+    float increment[kAudioBlockSize];
+    bool steady = false;
 
-    float freq_lp = self->freq_lp;
-    float shape_lp = self->shape_lp;
-    float slope_lp = self->slope_lp;
-    float shift_lp = self->shift_lp;
-    float smooth_lp = self->smooth_lp;
+    // check for gate/trigger input
+    if (use_trigger && trig_connected)
+    {
 
-    float r_sr = self->r_sr;
+        gate_flags = self->gate_input;
+        for (int i = 0; i < kAudioBlockSize; ++i)
+        {
+            bool trig = trig_in[i] > 0.01;
+            previous_flags[0] = stmlib::ExtractGateFlags(previous_flags[0], trig);
+            gate_flags[i] = previous_flags[0];
+        }
+    }
 
-    for (int count = 0; count < vs; count += kAudioBlockSize)
+    if (use_phase)
+    {
+        // the ramp comes straight from the phase inlet, no extraction
+        float master_frequency = phase_input(&self->follower, clock_in, ramp, kAudioBlockSize);
+        ratio_follow(&self->follower, self->r_, ramp, ramp, kAudioBlockSize);
+        frequency = fabsf(master_frequency) * self->r_.ratio;
+        CONSTRAIN(frequency, 0.f, 0.4f);
+        self->must_reset_ramp_extractor = true;
+    }
+    else if (use_clock && clock_connected && bus_ramp)
+    {
+        ratio_follow(&self->follower, self->r_, bus_ramp, ramp, kAudioBlockSize);
+        frequency = bus_frequency * self->r_.ratio;
+        self->must_reset_ramp_extractor = true;
+    }
+    else if (use_clock && clock_connected)
     {
 
-        // check for gate/trigger input
-        if (use_trigger && trig_connected)
+        if (self->must_reset_ramp_extractor)
         {
+            ramp_extractor->Reset();
+        }
 
-            gate_flags = self->gate_input;
-            for (int i = 0; i < kAudioBlockSize; ++i)
-            {
-                bool trig = trig_in[i + count] > 0.01;
-                previous_flags[0] = stmlib::ExtractGateFlags(previous_flags[0], trig);
-                gate_flags[i] = previous_flags[0];
-            }
+        for (int i = 0; i < kAudioBlockSize; ++i)
+        {
+            bool trig = clock_in[i] > 0.01;
+            previous_flags[1] = stmlib::ExtractGateFlags(previous_flags[1], trig);
+            clock_input[i] = previous_flags[1];
         }
 
-        if (use_clock && clock_connected)
+        frequency = ramp_extractor->Process(range,
+                                            range == tides::RANGE_AUDIO && ramp_mode == tides::RAMP_MODE_AR,
+                                            self->r_,
+                                            clock_input,
+                                            ramp,
+                                            kAudioBlockSize);
+
+        self->must_reset_ramp_extractor = false;
+    }
+    else
+    {
+        frequency = block_frequency(self, freq_in, increment, &steady);
+        self->must_reset_ramp_extractor = true;
+    }
+
+    // parameter inputs
+    shape = self->shape + (float)shape_in[0];
+    CONSTRAIN(shape, 0.f, 1.f);
+    ONE_POLE(self->shape_lp, shape, 0.1f);
+    slope = self->slope + (float)slope_in[0];
+    CONSTRAIN(slope, 0.f, 1.f);
+    ONE_POLE(self->slope_lp, slope, 0.1f);
+    smoothness = self->smoothness + (float)smooth_in[0];
+    CONSTRAIN(smoothness, 0.f, 1.f);
+    ONE_POLE(self->smooth_lp, smoothness, 0.1f);
+    shift = self->shift + shift_in[0];
+    CONSTRAIN(shift, 0.f, 1.f);
+    ONE_POLE(self->shift_lp, shift, 0.1f);
+
+    // free running loop: loop_phase follows the live generator's own phase
+    // until the cycle cache first plays, so that it starts in phase. From
+    // then on the wrapper owns the phase and drives the generator from it,
+    // so the two can take over from each other seamlessly; it does the same
+    // for audio rate FM (through zero, too), applied sample by sample.
+    bool free_running = (self->cycle_cache || self->freq_mode != FREQ_MODE_LINEAR) &&
+                        ramp_mode == tides::RAMP_MODE_LOOPING &&
+                        output_mode != tides::OUTPUT_MODE_FREQUENCY &&
+                        !(use_trigger && trig_connected) &&
+                        !(use_clock && clock_connected) &&
+                        !use_phase;
+
+    if (free_running)
+    {
+        // parameters moved away from the cached (or half built) waveform
+        if ((self->cache_valid || self->cache_building) &&
+            (!steady || increment[0] != self->cache_frequency ||
+             fabsf(shape - self->cache_shape) > kSettleThreshold ||
+             fabsf(slope - self->cache_slope) > kSettleThreshold ||
+             fabsf(smoothness - self->cache_smooth) > kSettleThreshold ||
+             fabsf(shift - self->cache_shift) > kSettleThreshold ||
+             output_mode != self->cache_output_mode ||
+             range != self->cache_range))
         {
+            self->cache_valid = false;
+            self->cache_building = false;
+        }
 
-            if (must_reset_ramp_extractor)
-            {
-                ramp_extractor->Reset();
-            }
+        // one period has to fit the table
+        if (!self->cache_valid && !self->cache_building && self->cycle_cache && steady &&
+            increment[0] * kCycleTableSize >= 1.f &&
+            fabsf(shape - self->shape_lp) < kSettleThreshold &&
+            fabsf(slope - self->slope_lp) < kSettleThreshold &&
+            fabsf(smoothness - self->smooth_lp) < kSettleThreshold &&
+            fabsf(shift - self->shift_lp) < kSettleThreshold)
+        {
+            size_t period = static_cast<size_t>(ceilf(1.f / increment[0]));
+            while (static_cast<float>(period - 1) * increment[0] >= 1.f)
+                --period;
+            self->cache_shape = shape;
+            self->cache_slope = slope;
+            self->cache_smooth = smoothness;
+            self->cache_shift = shift;
+            self->cache_frequency = increment[0];
+            self->cache_period = period;
+            self->cache_output_mode = output_mode;
+            self->cache_range = range;
+            self->cache_build_position = 0;
+            self->cache_building = true;
+        }
 
-            for (int i = 0; i < kAudioBlockSize; ++i)
+        if (self->cache_building)
+        {
+            uint64_t trace_begin = self->trace.Begin();
+            if (cycle_cache_build(self))
             {
-                bool trig = clock_in[i + count] > 0.01;
-                previous_flags[1] = stmlib::ExtractGateFlags(previous_flags[1], trig);
-                clock_input[i] = previous_flags[1];
+                self->cache_building = false;
+                self->cache_valid = true;
             }
+            self->trace.End(self, "cycle_cache_build", trace_begin);
+        }
 
-            frequency = ramp_extractor->Process(range,
-                                                range == tides::RANGE_AUDIO && ramp_mode == tides::RAMP_MODE_AR,
-                                                self->r_,
-                                                clock_input,
-                                                ramp,
-                                                kAudioBlockSize);
-
-            must_reset_ramp_extractor = false;
+        if (self->cache_valid)
+        {
+            cycle_cache_play(self, increment[0], outs);
+            self->loop_owned = true;
+            return;
         }
-        else
+
+        float phase = self->loop_phase;
+        for (size_t i = 0; i < kAudioBlockSize; ++i)
         {
-            frequency = (freq_in[count] + freq_knob) * r_sr;
-            CONSTRAIN(frequency, 0.f, 0.4f);
-            // no filtering for now
-            //            ONE_POLE(freq_lp, frequency, 0.3f);
-            //            frequency = freq_lp;
-            must_reset_ramp_extractor = true;
+            phase += increment[i];
+            if (phase >= 1.f)
+                phase -= 1.f;
+            else if (phase < 0.f)
+                phase += 1.f;
+            ramp[i] = phase;
         }
+        self->loop_phase = phase;
+    }
+    else
+    {
+        self->cache_valid = false;
+        self->cache_building = false;
+        self->loop_owned = false;
+    }
 
-        // parameter inputs
-        shape = shape_knob + (float)shape_in[count];
-        CONSTRAIN(shape, 0.f, 1.f);
-        ONE_POLE(shape_lp, shape, 0.1f);
-        slope = slope_knob + (float)slope_in[count];
-        CONSTRAIN(slope, 0.f, 1.f);
-        ONE_POLE(slope_lp, slope, 0.1f);
-        smoothness = smoothness_knob + (float)smooth_in[count];
-        CONSTRAIN(smoothness, 0.f, 1.f);
-        ONE_POLE(smooth_lp, smoothness, 0.1f);
-        shift = shift_knob + shift_in[count];
-        CONSTRAIN(shift, 0.f, 1.f);
-        ONE_POLE(shift_lp, shift, 0.1f);
-
-        self->poly_slope_generator.Render(ramp_mode,
-                                          output_mode,
-                                          range,
-                                          frequency, slope_lp, shape_lp, smooth_lp, shift_lp,
-                                          gate_flags,
-                                          !use_trigger && use_clock ? ramp : NULL,
-                                          out, kAudioBlockSize);
+    bool owned = free_running && (self->loop_owned || self->freq_mode != FREQ_MODE_LINEAR);
+    self->poly_slope_generator.Render(ramp_mode,
+                                      output_mode,
+                                      range,
+                                      frequency, self->slope_lp, self->shape_lp, self->smooth_lp, self->shift_lp,
+                                      gate_flags,
+                                      owned || (!use_trigger && (use_clock || use_phase)) ? ramp : NULL,
+                                      out, kAudioBlockSize);
 
-        for (int i = 0; i < kAudioBlockSize; ++i)
+    if (!pdmi::is_finite(&out[0].channel[0], kAudioBlockSize * kNumOutputs))
+    {
+        // NaN or Inf in the generator or the ramp extractor: start over
+        self->poly_slope_generator.Init();
+        self->ramp_extractor.Init(self->sr, 40.0f * self->r_sr);
+        self->loop_phase = 0.f;
+        memset(out, 0, sizeof(self->out));
+        self->nan_resets++;
+        self->trace.Instant(self, "nan_reset", output_mode);
+    }
+
+    for (int i = 0; i < kAudioBlockSize; ++i)
+    {
+        for (int j = 0; j < kNumOutputs; ++j)
         {
-            for (int j = 0; j < kNumOutputs; ++j)
-            {
-                ((t_sample *)w[j + 9])[i + count] = out[i].channel[j] * 0.1f;
-            }
+            outs[j][i] = out[i].channel[j] * 0.1f;
         }
     }
+}
 
-    self->freq_lp = freq_lp;
-    self->shape_lp = shape_lp;
-    self->shift_lp = shift_lp;
-    self->slope_lp = slope_lp;
-    self->smooth_lp = smooth_lp;
+static t_int *myObj_perform(t_int *w)
+{
+    t_myObj *self = (t_myObj *)(w[1]);
+    pdmi::ScopedFlushDenormals flush;
+    t_sample **ins = (t_sample **)(w + 2);   // 7 inlets
+    t_sample **outs = (t_sample **)(w + 9);  // 4 outlets
+    int vs = (int)(w[13]); // sampleframes
+    uint64_t trace_begin = self->trace.Begin();
+    pdmi::RandomScope random(self->random_state);
 
-    self->must_reset_ramp_extractor = must_reset_ramp_extractor;
+    // the clock bus is analysed per Pd vector, so it needs aligned blocks
+    t_clock_bus *clock_bus = self->clock_bus;
+    if (clock_bus && (clock_bus->vs != vs || !self->adapter.direct()))
+        clock_bus = nullptr; // mismatch, reported in myObj_dsp
 
+    if (clock_bus && self->use_clock && self->clock_connected && !self->use_phase)
+    {
+        clock_bus_process(clock_bus, ins[6], vs, self->range,
+                          self->range == tides::RANGE_AUDIO && self->ramp_mode == tides::RAMP_MODE_AR,
+                          self->sr);
+    }
+    else
+    {
+        clock_bus = nullptr;
+    }
+
+    self->adapter.Process(ins, outs, vs, [self, clock_bus](t_sample *const *block_in, t_sample *const *block_out, int offset) {
+        if (clock_bus)
+            myObj_render_block(self, block_in, block_out,
+                               clock_bus->ramp + offset, clock_bus->frequency[offset / kAudioBlockSize]);
+        else
+            myObj_render_block(self, block_in, block_out, NULL, 0.f);
+    });
+
+    self->trace.EndPerform(self, trace_begin);
     return (w + 14);
 }
 
-void myObj_dsp(t_myObj *self, t_signal **sp)
+static t_int *myObj_perform_timed(t_int *w)
 {
-    // is a signal connected to the trigger/clock input?
+    t_myObj *self = (t_myObj *)(w[1]);
+    uint64_t start = pdmi::perf_ticks();
+    t_int *next = myObj_perform(w);
+    if (self->stats)
+        self->stats->Add(pdmi::perf_ticks() - start, (int)(w[13]));
+    return next;
+}
 
-    if (sys_getblksize() < kAudioBlockSize)
-    {
-        pd_error((t_object *)self, "sigvs can't be smaller than %zu samples, sorry!", kAudioBlockSize);
+void myObj_latency(t_myObj *self)
+{
+    post("pd.mi.tds~: latency %zu samples", self->adapter.latency());
+}
+
+#pragma mark----- timing -----
+
+void myObj_timing(t_myObj *self, t_floatarg t)
+{
+    bool on = t != 0.f;
+    if (on == (self->stats != nullptr))
         return;
+    if (on)
+        self->stats = new pdmi::PerfStats;
+    else
+    {
+        delete self->stats;
+        self->stats = nullptr;
     }
+    // swap the perform routine
+    canvas_update_dsp();
+}
+
+void myObj_stats(t_myObj *self)
+{
+    post("pd.mi.tds~: %ld NaN resets", self->nan_resets);
+    if (self->stats)
+        pdmi::perf_post("pd.mi.tds~", self->stats->Summarize(self->sr));
+    else
+        post("pd.mi.tds~: timing is off, send 'timing 1' first");
+}
+
+void myObj_stats_reset(t_myObj *self)
+{
+    self->nan_resets = 0;
+    if (self->stats)
+        self->stats->Reset();
+}
+
+void myObj_trace_dump(t_myObj *self, t_symbol *file)
+{
+    pdmi::trace_dump((t_object *)self, "pd.mi.tds~", file);
+}
+
+void myObj_dsp(t_myObj *self, t_signal **sp)
+{
     if (sys_getsr() != self->sr)
     {
         self->sr = sys_getsr();
         self->r_sr = 1.0f / self->sr;
     }
 
-    dsp_add(myObj_perform, 13 /* x+inlets+outlets+s_n */,
+    self->adapter.Configure(sp[0]->s_n);
+
+    if (self->clock_bus && !self->adapter.direct())
+    {
+        pd_error((t_object *)self, "clock bus %s: block size %d is not a multiple of %zu, using own clock analysis",
+                 self->clock_bus->name->s_name, sp[0]->s_n, kAudioBlockSize);
+    }
+    else if (self->clock_bus && !clock_bus_prepare(self->clock_bus, sp[0]->s_n, self->sr))
+    {
+        pd_error((t_object *)self, "clock bus %s: block size mismatch (%d vs %ld), using own clock analysis",
+                 self->clock_bus->name->s_name, sp[0]->s_n, self->clock_bus->vs);
+    }
+
+    dsp_add(self->stats ? myObj_perform_timed : myObj_perform, 13 /* x+inlets+outlets+s_n */,
             self,
             sp[0]->s_vec, // 7 inlets
             sp[1]->s_vec,
@@ -550,6 +1207,17 @@ void myObj_free(t_myObj *self)
     self->poly_slope_generator.~PolySlopeGenerator();
     self->ramp_extractor.~RampExtractor();
 
+    if (self->clock_bus)
+        clock_bus_release(self->clock_bus);
+
+    if (self->cache_table)
+    {
+        freebytes(self->cache_table, kNumOutputs * (kCycleTableSize + 1) * sizeof(float));
+        delete self->cache_generator;
+    }
+
+    delete self->stats;
+
     inlet_free(self->m_shape);
     inlet_free(self->m_slope);
     inlet_free(self->m_smooth);
@@ -580,6 +1248,7 @@ extern "C"
             CLASS_MAINSIGNALIN(this_class, t_myObj, m_f);
             // class_addmethod(this_class, (t_method)myObj_assist, gensym("assist"), A_CANT, 0);
             class_addmethod(this_class, (t_method)myObj_dsp, gensym("dsp"), A_CANT, 0);
+            class_addmethod(this_class, (t_method)myObj_latency, gensym("latency"), A_NULL);
 
             // class_addmethod(this_class, (t_method)myObj_int, gensym("int"), A_LONG, 0);
             // class_addmethod(this_class, (t_method)myObj_float, gensym("float"), A_FLOAT, 0);
@@ -589,6 +1258,7 @@ extern "C"
             class_addmethod(this_class, (t_method)myObj_slope, gensym("slope"), A_FLOAT, 0);
             class_addmethod(this_class, (t_method)myObj_smooth, gensym("smooth"), A_FLOAT, 0);
             class_addmethod(this_class, (t_method)myObj_ratio, gensym("ratio"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_seed, gensym("seed"), A_FLOAT, 0);
 
             // ATTRIBUTES ..............
             // output mode
@@ -599,6 +1269,10 @@ extern "C"
             // "AD LOOPING AR"
             class_addmethod(this_class, (t_method)ramp_mode_setter, gensym("ramp_mode"), A_FLOAT, 0);
             logpost(this_class, 3, "pd.mi.tds~ @ramp mode: 0: AD, 1: LOOPING, 2: AR");
+            // frequency input mode
+            // "LINEAR EXPONENTIAL THROUGH-ZERO"
+            class_addmethod(this_class, (t_method)freq_mode_setter, gensym("freq_mode"), A_FLOAT, 0);
+            logpost(this_class, 3, "pd.mi.tds~ @freq_mode: 0: LINEAR (Hz), 1: EXPONENTIAL (1/oct), 2: THROUGH-ZERO (Hz)");
             // range
             // "CONTROL AUDIO"
             class_addmethod(this_class, (t_method)range_setter, gensym("range"), A_FLOAT, 0);
@@ -607,6 +1281,22 @@ extern "C"
             class_addmethod(this_class, (t_method)myObj_plug, gensym("plug"), A_GIMME, 0);
             logpost(this_class, 3, "pd.mi.tds~ @use_trig: 0|1");
             logpost(this_class, 3, "pd.mi.tds~ @use_clock: 0|1");
+            // clock bus
+            class_addmethod(this_class, (t_method)myObj_clock_bus, gensym("clock_bus"), A_DEFSYMBOL, 0);
+            logpost(this_class, 3, "pd.mi.tds~ @clock_bus: <name>");
+            // phase input
+            class_addmethod(this_class, (t_method)myObj_use_phase, gensym("use_phase"), A_FLOAT, 0);
+            logpost(this_class, 3, "pd.mi.tds~ @use_phase: 0|1 (clock inlet takes a 0..1 phase)");
+            // cycle cache
+            class_addmethod(this_class, (t_method)myObj_cycle_cache, gensym("cycle_cache"), A_FLOAT, 0);
+            logpost(this_class, 3, "pd.mi.tds~ @cycle_cache: 0|1");
+            // perform timing
+            class_addmethod(this_class, (t_method)myObj_timing, gensym("timing"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_stats, gensym("stats"), A_NULL);
+            class_addmethod(this_class, (t_method)myObj_stats_reset, gensym("stats_reset"), A_NULL);
+            class_addmethod(this_class, (t_method)myObj_trace_dump, gensym("trace_dump"), A_DEFSYMBOL, 0);
+            pdmi::trace_setup();
+            logpost(this_class, 3, "pd.mi.tds~ @timing: 0|1");
 
             logpost(this_class, 3, "pd.mi.tds~ by Przemysław Sanecki -- https://software-materialism.org");
             logpost(this_class, 3, "based on vb.mi.tds~ by Volker Böhm -- https://vboehm.net");
@@ -30,11 +30,23 @@
 #include <m_pd.h>
 
 #include "warps/dsp/modulator.h"
-
+#include "read_inputs.hpp"
+#include "resampler.h"
+#include "denormals.h"
+#include "perf_stats.h"
+#include "random_state.h"
+#include "trace.h"
+
+#include <algorithm>
 #include <cstring>
 #include <cstdlib>
 #include <optional>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define WRAPS_SSE2 1
+#endif
+
 using std::clamp;
 
 // TODO: work on block size and SR, use libsamplerate for downsampling?
@@ -43,13 +55,18 @@ using std::clamp;
 const size_t kBlockSize = 64; // has to stay like that TODO: why?
 
 static t_class *this_class;
+static uint32_t instance_count = 0; // for the default seeds
 
 struct t_myObj
 {
     t_object m_obj; // pd object - always placed in first in the object's struct
 
     warps::Modulator *modulator;
+    warps::ReadInputs *read_inputs;
 
+    float adc_inputs[warps::ADC_LAST];
+    double cv_sum[4]; // CV inlets, summed over the current internal block
+    double note_offset; // corrects the oscillator for the actual internal rate
     short patched[2];
     short easterEgg;
     uint8_t carrier_shape;
@@ -60,10 +77,25 @@ struct t_myObj
     long output_bytes;
     warps::ShortFrame *output;
 
+    // 2x oversampling: the modulator is initialised for 96 kHz, so running
+    // it at twice the host rate gets it (close to) its native tunings
+    bool oversample;
+    int os_factor;
+    float host_input[2][kBlockSize];
+    float host_output[2][kBlockSize];
+    float os_buffer[2][2 * kBlockSize];
+    pdmi::Upsampler2x upsampler[2];
+    pdmi::Downsampler2x downsampler[2];
+
     long count;
     double sr;
     int sigvs;
 
+    pdmi::PerfStats *stats; // perform timing, null unless on
+    long nan_resets;
+    uint32_t random_state; // this instance's stmlib::Random state
+    pdmi::TraceTrack trace;
+
     t_inlet *m_in2;
     t_inlet *m_level1;
     t_inlet *m_level2;
@@ -111,11 +143,57 @@ static void *myObj_new(t_symbol *s, int argc, t_atom *argv)
 
         self->modulator->mutable_parameters()->note = 0.0f; 
 
+        self->read_inputs = new warps::ReadInputs;
+        self->read_inputs->Init();
+        for (int i = 0; i < warps::ADC_LAST; i++)
+            self->adc_inputs[i] = 0.0f;
+        for (int i = 0; i < 4; i++)
+            self->cv_sum[i] = 0.0;
+
+        self->oversample = false;
+        self->os_factor = 1;
+        self->stats = nullptr;
+        self->nan_resets = 0;
+        self->random_state = pdmi::instance_seed(instance_count++);
+
         self->input_bytes = kBlockSize * sizeof(warps::ShortFrame);
         self->input = (warps::ShortFrame *)getbytes(self->input_bytes);
         self->output_bytes = kBlockSize * sizeof(warps::ShortFrame);
         self->output = (warps::ShortFrame *)getbytes(self->output_bytes);
 
+        // attributes ====
+        while (argc > 0)
+        {
+            if (argv->a_type == A_SYMBOL && argc >= 2)
+            {
+                t_symbol *curarg = atom_getsymbolarg(0, argc, argv);
+                if (strcmp(curarg->s_name, "@oversample") == 0)
+                {
+                    t_float argval = atom_getfloatarg(1, argc, argv);
+                    self->oversample = (int)argval != 0;
+                }
+                else if (strcmp(curarg->s_name, "@timing") == 0)
+                {
+                    t_float argval = atom_getfloatarg(1, argc, argv);
+                    if (argval != 0.f && !self->stats)
+                        self->stats = new pdmi::PerfStats;
+                }
+                argc -= 2;
+                argv += 2;
+            }
+            else
+            {
+                argc -= 1;
+                argv += 1;
+            }
+        }
+        self->os_factor = self->oversample && self->sr < 88200.0 ? 2 : 1;
+        self->note_offset = log2(self->sr * self->os_factor / 96000.0) * 12.0;
+        for (int i = 0; i < 2; i++)
+        {
+            self->upsampler[i].Init();
+            self->downsampler[i].Init();
+        }
     }
 
     return (void *)self;
@@ -146,7 +224,7 @@ void myObj_modulation_algo(t_myObj *self, float m)
     // Selects which signal processing operation is performed on the carrier and modulator.
     m *= 0.125;
     verbose(3, "modulation algo %f", m);
-    self->modulator->mutable_parameters()->modulation_algorithm = clamp(m, 0.0f, 1.0f);
+    self->adc_inputs[warps::ADC_ALGORITHM_POT] = clamp(m, 0.0f, 1.0f);
 }
 
 void myObj_modulation_timbre(t_myObj *self, float m)
@@ -154,7 +232,7 @@ void myObj_modulation_timbre(t_myObj *self, float m)
     // Controls the intensity of the high harmonics created by cross-modulation
     // (or provides another dimension of tone control for some algorithms).
     verbose(3, "modulation timbre %f", m);
-    self->modulator->mutable_parameters()->modulation_parameter = clamp(m, 0.0f, 1.0f);
+    self->adc_inputs[warps::ADC_PARAMETER_POT] = clamp(m, 0.0f, 1.0f);
 }
 // oscillator button
 
@@ -175,14 +253,14 @@ void myObj_level1(t_myObj *self, float m)
     // External carrier amplitude or internal oscillator frequency.
     // When the internal oscillator is switched off, this knob controls the amplitude of the carrier, or the amount of amplitude modulation from the channel 1 LEVEL CV input (1). When the internal oscillator is active, this knob controls its frequency.
     verbose(3, "level 1 %f", m);
-    self->modulator->mutable_parameters()->channel_drive[0] = clamp(m, 0.0f, 1.0f);
+    self->adc_inputs[warps::ADC_LEVEL_1_POT] = clamp(m, 0.0f, 1.0f);
 }
 
 void myObj_level2(t_myObj *self, float m)
 {
     // This knob controls the amplitude of the modulator, or the amount of amplitude modulation from the channel 2 LEVEL CV input (2). Past a certain amount of gain, the signal soft clips.
     verbose(3, "level 2 %f", m);
-    // self->modulator->mutable_parameters()->channel_drive[1] = clamp(m, 0.0f, 1.0f);
+    self->adc_inputs[warps::ADC_LEVEL_2_POT] = clamp(m, 0.0f, 1.0f);
 }
 
 #pragma mark-------- other messages ----------
@@ -193,6 +271,22 @@ void myObj_freq(t_myObj *self, float n)
     self->modulator->mutable_parameters()->note = clamp(n, 0.0f, 1.0f);
 }
 
+void myObj_oversample(t_myObj *self, float t)
+{
+    // runs the modulator at twice the host rate (96 kHz from 48 kHz, 88.2 kHz
+    // from 44.1 kHz); hosts at 88.2 kHz and above already run it natively
+    self->oversample = (int)t != 0;
+    self->os_factor = self->oversample && self->sr < 88200.0 ? 2 : 1;
+    self->note_offset = log2(self->sr * self->os_factor / 96000.0) * 12.0;
+    for (int i = 0; i < 2; i++)
+    {
+        self->upsampler[i].Init();
+        self->downsampler[i].Init();
+    }
+    self->trace.Instant(self, "oversample", self->os_factor);
+    verbose(3, "oversample %i, internal rate %f", self->oversample, self->sr * self->os_factor);
+}
+
 void myObj_bypass(t_myObj *self, float t)
 {
     self->modulator->set_bypass((int)t != 0);
@@ -213,9 +307,168 @@ void myObj_easter_egg(t_myObj *self, float t)
     self->modulator->set_easter_egg(self->easterEgg);
 }
 
+void myObj_seed(t_myObj *self, t_floatarg s)
+{
+    self->random_state = pdmi::seed_state(s);
+}
+
+#pragma mark-------- int16 conversion ----------
+
+// the codec path of the module: audio in [-2, 2] is scaled to int16 and
+// truncated with saturation, int16 goes back to [-1, 1]
+const float kPackScale = 0.5f * 0x8000;
+const float kUnpackScale = 1.0f / 0x8000;
+
+template <typename T>
+static inline void pack_frames(const T *l, const T *r, warps::ShortFrame *out, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        out[i].l = (short)clamp(l[i] * kPackScale, -32768.0f, 32767.0f);
+        out[i].r = (short)clamp(r[i] * kPackScale, -32768.0f, 32767.0f);
+    }
+}
+
+template <typename T>
+static inline void unpack_frames(const warps::ShortFrame *in, T *l, T *r, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        l[i] = in[i].l * kUnpackScale;
+        r[i] = in[i].r * kUnpackScale;
+    }
+}
+
+#ifdef WRAPS_SSE2
+static inline void pack_frames(const float *l, const float *r, warps::ShortFrame *out, size_t size)
+{
+    const __m128 scale = _mm_set1_ps(kPackScale);
+    const __m128 lo = _mm_set1_ps(-32768.0f);
+    const __m128 hi = _mm_set1_ps(32767.0f);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        // clamp before the conversion, cvtt returns INT_MIN out of range
+        __m128i l0 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(l + i), scale), lo), hi));
+        __m128i l1 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(l + i + 4), scale), lo), hi));
+        __m128i r0 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(r + i), scale), lo), hi));
+        __m128i r1 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(r + i + 4), scale), lo), hi));
+        __m128i l16 = _mm_packs_epi32(l0, l1);
+        __m128i r16 = _mm_packs_epi32(r0, r1);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_unpacklo_epi16(l16, r16));
+        _mm_storeu_si128((__m128i *)(out + i + 4), _mm_unpackhi_epi16(l16, r16));
+    }
+    pack_frames<float>(l + i, r + i, out + i, size - i);
+}
+
+static inline void unpack_frames(const warps::ShortFrame *in, float *l, float *r, size_t size)
+{
+    const __m128 scale = _mm_set1_ps(kUnpackScale);
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4)
+    {
+        // four {l, r} frames, l in the low half of each 32 bit lane
+        __m128i frames = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i l32 = _mm_srai_epi32(_mm_slli_epi32(frames, 16), 16);
+        __m128i r32 = _mm_srai_epi32(frames, 16);
+        _mm_storeu_ps(l + i, _mm_mul_ps(_mm_cvtepi32_ps(l32), scale));
+        _mm_storeu_ps(r + i, _mm_mul_ps(_mm_cvtepi32_ps(r32), scale));
+    }
+    unpack_frames<float>(in + i, l + i, r + i, size - i);
+}
+#endif
+
+#pragma mark-------- perform ----------
+
+// pots and the CVs averaged over the block go through the same input stage
+// as wrps~, which smoothes them and combines pot and CV per parameter
+static void myObj_update_parameters(t_myObj *self)
+{
+    warps::Parameters *p = self->modulator->mutable_parameters();
+    float *adc_inputs = self->adc_inputs;
+    double *cv_sum = self->cv_sum;
+
+    for (int idx = 0; idx < 4; idx++)
+    {
+        adc_inputs[idx] = (float)(cv_sum[idx] / kBlockSize);
+        cv_sum[idx] = 0.0;
+    }
+    self->read_inputs->Read(p, adc_inputs, self->patched, (float)kBlockSize / warps::ReadInputs::kReferenceBlock);
+
+    p->note = 60.0 * adc_inputs[warps::ADC_LEVEL_1_CV] + 12.0 * adc_inputs[warps::ADC_LEVEL_2_CV] + 12.0;
+    p->note += self->note_offset;
+}
+
+// runs one host block through the modulator at twice the host rate
+static void myObj_process_oversampled(t_myObj *self)
+{
+    float(*os_buffer)[2 * kBlockSize] = self->os_buffer;
+
+    self->upsampler[0].Process(self->host_input[0], os_buffer[0], kBlockSize, 1);
+    self->upsampler[1].Process(self->host_input[1], os_buffer[1], kBlockSize, 1);
+
+    for (size_t offset = 0; offset < 2 * kBlockSize; offset += kBlockSize)
+    {
+        pack_frames(os_buffer[0] + offset, os_buffer[1] + offset, self->input, kBlockSize);
+        self->modulator->Process(self->input, self->output, kBlockSize);
+        unpack_frames(self->output, os_buffer[0] + offset, os_buffer[1] + offset, kBlockSize);
+    }
+
+    self->downsampler[0].Process(os_buffer[0], self->host_output[0], kBlockSize, 1);
+    self->downsampler[1].Process(os_buffer[1], self->host_output[1], kBlockSize, 1);
+}
+
+// the modulator's 16-bit output can't carry NaN or Inf, so the check is on
+// what feeds its float state: the parameters (CV inlets, 'freq') and, when
+// oversampling, the upsampled input. A NaN that gets in stays there and
+// leaves the output stuck.
+static bool myObj_block_finite(t_myObj *self)
+{
+    const warps::Parameters *p = self->modulator->mutable_parameters();
+    const float parameters[] = {p->channel_drive[0], p->channel_drive[1], p->modulation_algorithm,
+                                p->modulation_parameter, p->frequency_shift_pot, p->frequency_shift_cv,
+                                p->phase_shift, p->note};
+    if (!pdmi::is_finite(parameters, sizeof(parameters) / sizeof(parameters[0])))
+        return false;
+    return self->os_factor == 1 || pdmi::is_finite(&self->os_buffer[0][0], 2 * 2 * kBlockSize);
+}
+
+// updates the parameters and runs one internal block
+static void myObj_process_block(t_myObj *self)
+{
+    myObj_update_parameters(self);
+    if (self->os_factor == 1)
+        self->modulator->Process(self->input, self->output, kBlockSize);
+    else
+        myObj_process_oversampled(self);
+
+    if (!myObj_block_finite(self))
+    {
+        // start over with the same parameters; the input stage is reset as
+        // well, its smoothing would hand the NaN back on the next block
+        warps::Parameters parameters = *self->modulator->mutable_parameters();
+        bool bypass = self->modulator->bypass();
+        self->modulator->Init(96000.0f);
+        *self->modulator->mutable_parameters() = parameters;
+        self->modulator->set_bypass(bypass);
+        self->modulator->set_easter_egg(self->easterEgg);
+        self->read_inputs->Init();
+        for (int i = 0; i < 2; i++)
+        {
+            self->upsampler[i].Init();
+            self->downsampler[i].Init();
+        }
+        memset(self->output, 0, self->output_bytes);
+        memset(self->host_output, 0, sizeof(self->host_output));
+        self->nan_resets++;
+        self->trace.Instant(self, "nan_reset", 0);
+    }
+}
+
 static t_int *myObj_perform(t_int *w)
 {
     t_myObj *self = (t_myObj *)(w[1]);
+    pdmi::ScopedFlushDenormals flush;
     t_sample *in1 = (t_sample *)(w[2]);
     t_sample *in2 = (t_sample *)(w[3]);
     t_sample *level1 = (t_sample *)(w[4]);
@@ -225,51 +478,114 @@ static t_int *myObj_perform(t_int *w)
     t_sample *out = (t_sample *)(w[8]);
     t_sample *aux = (t_sample *)(w[9]);
     int vs = (int)(w[10]);
+    uint64_t trace_begin = self->trace.Begin();
+    pdmi::RandomScope random(self->random_state);
 
     long count = self->count;
+    double *cv_sum = self->cv_sum;
 
-	warps::Parameters* p = self->modulator->mutable_parameters();
-
-    for (int i = 0; i < vs; ++i)
+    // the host vector is walked in segments that end on internal block
+    // boundaries, so the conversions run over contiguous spans
+    for (int i = 0; i < vs;)
     {
-        if (count >= kBlockSize)
+        if (count >= (long)kBlockSize)
         {
+            myObj_process_block(self);
             count = 0;
-            p->channel_drive[0] = clamp(p->channel_drive[0] + level1[i], 0.0f, 1.0f);
-            p->channel_drive[1] = clamp(p->channel_drive[1] + level2[i], 0.0f, 1.0f);
-            p->modulation_algorithm = clamp(p->modulation_algorithm + algo[i], 0.0f, 1.0f);
-
-            p->modulation_parameter = clamp(p->modulation_parameter + timbre[i], 0.0f, 1.0f);
-
-            p->frequency_shift_pot = p->modulation_algorithm;
-            p->frequency_shift_cv = clamp(algo[i], -1.0f, 1.0f);
-            p->phase_shift = p->modulation_algorithm;
-			p->note = 60.0 * level1[i] + 12.0 * level2[i] + 12.0;
-			p->note += log2f( self->sr / 96000.0f) * 12.0f;
-
-            self->modulator->Process(self->input, self->output, kBlockSize);
         }
-        self->input[count].l = clamp((int)(in1[i] / 2.0 * 0x8000), -0x8000, 0x7fff);
-        self->input[count].r = clamp((int)(in2[i] / 2.0 * 0x8000), -0x8000, 0x7fff);
 
-        out[i] =  ((t_sample)self->output[count].l / 0x8000);
-        aux[i] =  ((t_sample)self->output[count].r / 0x8000);
-        count++;
+        size_t n = std::min((long)kBlockSize - count, (long)(vs - i));
+        for (size_t j = 0; j < n; ++j)
+        {
+            cv_sum[0] += level1[i + j];
+            cv_sum[1] += level2[i + j];
+            cv_sum[2] += algo[i + j];
+            cv_sum[3] += timbre[i + j];
+        }
+        if (self->os_factor == 1)
+        {
+            pack_frames(in1 + i, in2 + i, self->input + count, n);
+            unpack_frames(self->output + count, out + i, aux + i, n);
+        }
+        else
+        {
+            for (size_t j = 0; j < n; ++j)
+            {
+                self->host_input[0][count + j] = in1[i + j];
+                self->host_input[1][count + j] = in2[i + j];
+                out[i + j] = self->host_output[0][count + j];
+                aux[i + j] = self->host_output[1][count + j];
+            }
+        }
+        count += n;
+        i += n;
     }
 
     self->count = count;
+    self->trace.EndPerform(self, trace_begin);
     return (w + 11);
 }
 
+static t_int *myObj_perform_timed(t_int *w)
+{
+    t_myObj *self = (t_myObj *)(w[1]);
+    uint64_t start = pdmi::perf_ticks();
+    t_int *next = myObj_perform(w);
+    if (self->stats)
+        self->stats->Add(pdmi::perf_ticks() - start, (int)(w[10]));
+    return next;
+}
+
+#pragma mark----- timing -----
+
+void myObj_timing(t_myObj *self, t_floatarg t)
+{
+    bool on = t != 0.f;
+    if (on == (self->stats != nullptr))
+        return;
+    if (on)
+        self->stats = new pdmi::PerfStats;
+    else
+    {
+        delete self->stats;
+        self->stats = nullptr;
+    }
+    // swap the perform routine
+    canvas_update_dsp();
+}
+
+void myObj_stats(t_myObj *self)
+{
+    post("pd.mi.wraps~: %ld NaN resets", self->nan_resets);
+    if (self->stats)
+        pdmi::perf_post("pd.mi.wraps~", self->stats->Summarize(self->sr));
+    else
+        post("pd.mi.wraps~: timing is off, send 'timing 1' first");
+}
+
+void myObj_stats_reset(t_myObj *self)
+{
+    self->nan_resets = 0;
+    if (self->stats)
+        self->stats->Reset();
+}
+
+void myObj_trace_dump(t_myObj *self, t_symbol *file)
+{
+    pdmi::trace_dump((t_object *)self, "pd.mi.wraps~", file);
+}
+
 static void myObj_dsp(t_myObj *self, t_signal **sp)
 {
-    // t_float samplerate = sys_getsr();
-    // if (samplerate != self->sr)
-    // {
-    //     self->sr = samplerate;
-    //     self->modulator->Init(self->sr);
-    // }
-    dsp_add(myObj_perform, 10 /* x+inlets+outlets+s_n */,
+    // the modulator stays initialised for 96 kHz, the host rate only
+    // decides whether oversampling gets it there
+    t_float samplerate = sys_getsr();
+    if (samplerate != self->sr)
+    {
+        self->sr = samplerate;
+        myObj_oversample(self, self->oversample);
+    }
+    dsp_add(self->stats ? myObj_perform_timed : myObj_perform, 10 /* x+inlets+outlets+s_n */,
             self,
             sp[0]->s_vec, // 6 inlets
             sp[1]->s_vec,
@@ -319,6 +635,8 @@ static void myObj_free(t_myObj *self)
     outlet_free(self->m_out);
     outlet_free(self->m_aux);
     delete self->modulator;
+    delete self->read_inputs;
+    delete self->stats;
 
     freebytes(self->input, self->input_bytes);
     freebytes(self->output, self->output_bytes);
@@ -349,14 +667,23 @@ extern "C"
 
             class_addmethod(this_class, (t_method)myObj_freq, gensym("freq"), A_FLOAT, 0);
 
+            class_addmethod(this_class, (t_method)myObj_oversample, gensym("oversample"), A_FLOAT, 0);
             class_addmethod(this_class, (t_method)myObj_bypass, gensym("bypass"), A_FLOAT, 0);
             class_addmethod(this_class, (t_method)myObj_easter_egg, gensym("easteregg"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_seed, gensym("seed"), A_FLOAT, 0);
             class_addmethod(this_class, (t_method)myObj_plug, gensym("plug"), A_GIMME, 0);
             class_addmethod(this_class, (t_method)myObj_info, gensym("info"), A_GIMME, 0);
+            class_addmethod(this_class, (t_method)myObj_timing, gensym("timing"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_stats, gensym("stats"), A_NULL);
+            class_addmethod(this_class, (t_method)myObj_stats_reset, gensym("stats_reset"), A_NULL);
+            class_addmethod(this_class, (t_method)myObj_trace_dump, gensym("trace_dump"), A_DEFSYMBOL, 0);
+            pdmi::trace_setup();
 
+#ifndef PD_MI_LIBRARY
             post("pd.mi.wraps~ by przemysław sanecki --> https://software-materialism.org");
             post("vb.mi.wrps~ by volker böhm --> https://vboehm.net");
             post("a clone of mutable instruments' 'warps' module");
+#endif
         }
     }
 }
\ No newline at end of file
@@ -32,7 +32,15 @@
 #include "warps/dsp/modulator.h"
 #include "warps/dsp/oscillator.h"
 #include "read_inputs.hpp"
+#include "split_vocoder.hpp"
+#include "resampler.h"
+#include "fft_vocoder.h"
+#include "denormals.h"
+#include "perf_stats.h"
+#include "random_state.h"
+#include "trace.h"
 
+#include <algorithm>
 #include <cstring>
 #include <cstdlib>
 #include <optional>
@@ -42,9 +50,61 @@ using std::clamp;
 // TODO: work on block size and SR, use libsamplerate for downsampling?
 // original SR: 96 kHz, block size: 60
 
-const size_t kBlockSize = 96; // has to stay like that TODO: why?
+const size_t kBlockSize = 96; // largest internal block, see @blocksize
+// warps' vocoder FilterBank decimates its lower bands by 3 and 4, so every
+// block Processf gets has to be a multiple of 12 (split_vocoder.hpp)
+const long kBlockMultiple = pdmi::kVocoderBlockMultiple;
+const int kMaxChannels = 8;    // carrier/modulator pairs, see @channels
 
 static t_class *this_class;
+static uint32_t instance_count = 0; // for the default seeds
+
+// A vocoder bus lets several wrps~ share warps' modulator analysis. On the
+// vocoder algorithm (algo 8) with an external carrier, a subscriber runs
+// warps' vocoder split in two (split_vocoder.hpp): the first subscriber to
+// run in a DSP tick analyses its modulator for every internal block of the
+// tick, and each subscriber synthesises its own carrier from those bands.
+// Subscribers start their internal blocks together at each dsp update, so
+// block n of the tick covers the same samples for all of them.
+struct t_vocoder_bus
+{
+    t_symbol *name;
+    int refcount;
+    pdmi::VocoderAnalysis analysis;
+    double stamp;     // logical time of the last analysed tick
+    double dsp_stamp; // logical time of the last dsp chain build
+    long vs;
+    long block_size;
+    long blocks;  // analysed blocks per tick
+    float *bands; // analysis.block_size() floats per block
+    t_vocoder_bus *next;
+};
+
+static t_vocoder_bus *vocoder_buses = nullptr;
+
+// subscriber side: the carrier synthesis, plus an analysis of its own for
+// when the bus can't be used (block size mismatch)
+struct t_vocoder
+{
+    pdmi::VocoderAnalysis analysis;
+    pdmi::VocoderSynthesis synthesis;
+    float bands[pdmi::kVocoderMaxBandSamples];
+    long block;   // internal block within the tick
+    bool analyse; // first subscriber to run in the tick
+};
+
+// one carrier/modulator pair. Pair 0 uses the object's own modulator and
+// buffers, @channels adds more; all pairs share the control stage.
+struct t_pair
+{
+    warps::Modulator *modulator;
+    warps::FloatFrame *input;
+    warps::FloatFrame *output;
+    warps::FloatFrame *os_input;
+    warps::FloatFrame *os_output;
+    pdmi::Upsampler2x upsampler[2];
+    pdmi::Downsampler2x downsampler[2];
+};
 
 struct t_myObj
 {
@@ -53,7 +113,20 @@ struct t_myObj
     warps::Modulator *modulator;
     warps::ReadInputs *read_inputs;
 
-    double adc_inputs[warps::ADC_LAST];
+    t_vocoder_bus *vocoder_bus;
+    t_vocoder *vocoder;
+    bool vocoder_shared; // bus usable in the current dsp chain
+
+    // algo 9: FFT vocoder, one pair at the host rate only
+    pdmi::FftVocoder *fft_vocoder;
+    float *fft_aux; // aux delay line, as late as the vocoder's output
+    long fft_aux_position;
+    bool fft_mode;
+    long fft_size;
+    long fft_bands;
+
+    float adc_inputs[warps::ADC_LAST];
+    double cv_sum[4]; // CV inlets, summed over the current internal block
     short patched[2];
     short easterEgg;
     uint8_t carrier_shape;
@@ -64,10 +137,25 @@ struct t_myObj
     long output_bytes;
     warps::FloatFrame *output;
 
+    // 2x oversampling towards the module's native 96 kHz
+    bool oversample;
+    int os_factor;
+    warps::FloatFrame *os_input;
+    warps::FloatFrame *os_output;
+
+    t_pair pair[kMaxChannels];
+    long channels;
+
     long count;
+    long block_size;
     double sr;
     int sigvs;
 
+    pdmi::PerfStats *stats; // perform timing, null unless on
+    long nan_resets;
+    uint32_t random_state; // this instance's stmlib::Random state
+    pdmi::TraceTrack trace;
+
     t_inlet *m_in2;
     t_inlet *m_level1;
     t_inlet *m_level2;
@@ -84,6 +172,296 @@ struct t_myObj
     t_float m_f;
 };
 
+void myObj_blocksize(t_myObj *self, float n)
+{
+    // internal block size, a multiple of 12 from 12 to 96 samples (others
+    // are rounded down). If it divides the Pd vector size, blocks are
+    // processed in place with no added latency.
+    long block_size = clamp((long)n / kBlockMultiple * kBlockMultiple, kBlockMultiple, (long)kBlockSize);
+    if (block_size != (long)n)
+        pd_error((t_object *)self, "pd.mi.wrps~: block size %ld is not a multiple of %ld up to %ld, using %ld",
+                 (long)n, kBlockMultiple, (long)kBlockSize, block_size);
+    self->block_size = block_size;
+    self->count = 0;
+    for (long c = 0; c < self->channels; c++)
+    {
+        memset(self->pair[c].input, 0, self->input_bytes);
+        memset(self->pair[c].output, 0, self->output_bytes);
+    }
+    for (int i = 0; i < 4; i++)
+        self->cv_sum[i] = 0.0;
+    verbose(3, "blocksize %ld", self->block_size);
+}
+
+// (re)initialises the modulator at the internal rate, keeping its parameters
+static void myObj_init_modulator(t_myObj *self)
+{
+    uint64_t trace_begin = self->trace.Begin();
+    self->os_factor = self->oversample && self->sr < 88200.0 ? 2 : 1;
+
+    for (long c = 0; c < self->channels; c++)
+    {
+        t_pair *pair = &self->pair[c];
+        warps::Parameters parameters = *pair->modulator->mutable_parameters();
+        pair->modulator->Init(self->sr * self->os_factor);
+        *pair->modulator->mutable_parameters() = parameters;
+
+        for (int i = 0; i < 2; i++)
+        {
+            pair->upsampler[i].Init();
+            pair->downsampler[i].Init();
+        }
+    }
+    self->trace.End(self, "Modulator::Init", trace_begin);
+}
+
+#pragma mark-------- channels ----------
+
+static void myObj_check_fft_mode(t_myObj *self);
+
+static void myObj_pair_alloc(t_myObj *self, t_pair *pair)
+{
+    pair->modulator = new warps::Modulator;
+    memset(pair->modulator, 0, sizeof(*pair->modulator));
+    pair->modulator->Init(self->sr * self->os_factor);
+    *pair->modulator->mutable_parameters() = *self->modulator->mutable_parameters();
+    pair->modulator->set_bypass(self->modulator->bypass());
+    pair->modulator->set_easter_egg(self->easterEgg);
+    pair->input = (warps::FloatFrame *)getbytes(self->input_bytes);
+    pair->output = (warps::FloatFrame *)getbytes(self->output_bytes);
+    pair->os_input = (warps::FloatFrame *)getbytes(2 * self->input_bytes);
+    pair->os_output = (warps::FloatFrame *)getbytes(2 * self->output_bytes);
+    for (int i = 0; i < 2; i++)
+    {
+        pair->upsampler[i].Init();
+        pair->downsampler[i].Init();
+    }
+}
+
+static void myObj_pair_free(t_myObj *self, t_pair *pair)
+{
+    delete pair->modulator;
+    freebytes(pair->input, self->input_bytes);
+    freebytes(pair->output, self->output_bytes);
+    freebytes(pair->os_input, 2 * self->input_bytes);
+    freebytes(pair->os_output, 2 * self->output_bytes);
+}
+
+static void myObj_set_channels(t_myObj *self, float n)
+{
+    long channels = clamp((long)n, 1L, (long)kMaxChannels);
+#ifndef CLASS_MULTICHANNEL
+    if (channels > 1)
+    {
+        pd_error((t_object *)self, "pd.mi.wrps~: @channels needs a Pd with multichannel signals");
+        channels = 1;
+    }
+#endif
+    for (long c = self->channels; c < channels; c++)
+        myObj_pair_alloc(self, &self->pair[c]);
+    for (long c = channels; c < self->channels; c++)
+        myObj_pair_free(self, &self->pair[c]);
+    self->channels = channels;
+    myObj_blocksize(self, self->block_size);
+    verbose(3, "channels %ld", self->channels);
+}
+
+void myObj_channels(t_myObj *self, float n)
+{
+    // number of carrier/modulator pairs, 1 to 8. Inlets and outlets carry
+    // that many channels; a single channel carrier or modulator feeds all
+    // pairs, the CV inlets only use their first channel.
+    myObj_set_channels(self, n);
+    myObj_check_fft_mode(self);
+    canvas_update_dsp();
+}
+
+void myObj_oversample(t_myObj *self, float t)
+{
+    // runs the modulator at twice the host rate (96 kHz from 48 kHz, 88.2 kHz
+    // from 44.1 kHz); hosts at 88.2 kHz and above already run it natively
+    self->oversample = (int)t != 0;
+    myObj_init_modulator(self);
+    myObj_check_fft_mode(self);
+    verbose(3, "oversample %i, internal rate %f", self->oversample, self->sr * self->os_factor);
+}
+
+#pragma mark-------- vocoder bus ----------
+
+static t_vocoder_bus *vocoder_bus_acquire(t_symbol *name, float sr)
+{
+    for (t_vocoder_bus *bus = vocoder_buses; bus; bus = bus->next)
+    {
+        if (bus->name == name)
+        {
+            bus->refcount++;
+            return bus;
+        }
+    }
+
+    t_vocoder_bus *bus = new t_vocoder_bus;
+    bus->name = name;
+    bus->refcount = 1;
+    bus->analysis.Init(sr);
+    bus->stamp = -1.;
+    bus->dsp_stamp = -1.;
+    bus->vs = 0;
+    bus->block_size = 0;
+    bus->blocks = 0;
+    bus->bands = nullptr;
+    bus->next = vocoder_buses;
+    vocoder_buses = bus;
+    return bus;
+}
+
+static void vocoder_bus_free_bands(t_vocoder_bus *bus)
+{
+    if (bus->bands)
+        freebytes(bus->bands, bus->blocks * bus->analysis.block_size() * sizeof(float));
+    bus->bands = nullptr;
+    bus->blocks = 0;
+}
+
+static void vocoder_bus_release(t_vocoder_bus *bus)
+{
+    if (--bus->refcount > 0)
+        return;
+
+    for (t_vocoder_bus **link = &vocoder_buses; *link; link = &(*link)->next)
+    {
+        if (*link == bus)
+        {
+            *link = bus->next;
+            break;
+        }
+    }
+    vocoder_bus_free_bands(bus);
+    delete bus;
+}
+
+// called from the dsp method, before any perform routine runs.
+// All subscribers of a bus have to run at the same vector and block size.
+static bool vocoder_bus_prepare(t_vocoder_bus *bus, long vs, long block_size, float sr)
+{
+    double now = clock_getlogicaltime();
+    if (bus->dsp_stamp == now)
+        return bus->vs == vs && bus->block_size == block_size;
+    bus->dsp_stamp = now;
+
+    // a vector holds at most this many internal block boundaries
+    long blocks = vs / block_size + 1;
+    vocoder_bus_free_bands(bus);
+    bus->analysis.Init(sr);
+    bus->bands = (float *)getbytes(blocks * bus->analysis.block_size() * sizeof(float));
+    bus->blocks = blocks;
+    bus->stamp = -1.;
+    bus->vs = vs;
+    bus->block_size = block_size;
+    return true;
+}
+
+// true for the first subscriber to run in this tick, which does the analysis
+static bool vocoder_bus_claim(t_vocoder_bus *bus)
+{
+    double now = clock_getlogicaltime();
+    if (now == bus->stamp)
+        return false;
+    bus->stamp = now;
+    return true;
+}
+
+void myObj_vocoder_bus(t_myObj *self, t_symbol *name)
+{
+    // joins the named bus: on the vocoder algorithm (algo 8) with the
+    // internal oscillator off, the modulator's band analysis is shared with
+    // the other subscribers and only the first to run in a tick computes
+    // it, from its own right inlet and level 2. Everything else works as
+    // usual. No name leaves the bus.
+    if (self->vocoder_bus)
+    {
+        vocoder_bus_release(self->vocoder_bus);
+        self->vocoder_bus = nullptr;
+        delete self->vocoder;
+        self->vocoder = nullptr;
+    }
+    if (name && *name->s_name)
+    {
+        self->vocoder_bus = vocoder_bus_acquire(name, self->sr);
+        self->vocoder = new t_vocoder;
+        self->vocoder->analysis.Init(self->sr);
+        self->vocoder->synthesis.Init(self->sr);
+    }
+    self->vocoder_shared = false;
+    canvas_update_dsp();
+}
+
+#pragma mark-------- FFT vocoder ----------
+
+static void myObj_reset_fft_aux(t_myObj *self)
+{
+    memset(self->fft_aux, 0, pdmi::kFftVocoderMaxSize * sizeof(float));
+    self->fft_aux_position = 0;
+}
+
+static void myObj_init_fft_vocoder(t_myObj *self)
+{
+    if (self->fft_vocoder)
+    {
+        self->fft_vocoder->Init(self->sr, self->fft_size, self->fft_bands);
+        myObj_reset_fft_aux(self);
+    }
+}
+
+// the FFT vocoder has no multichannel or oversampled version: with either
+// on, algo 9 falls back to warps' vocoder (algo 8)
+static bool myObj_fft_supported(t_myObj *self)
+{
+    return self->channels == 1 && !self->oversample;
+}
+
+static void myObj_check_fft_mode(t_myObj *self)
+{
+    if (self->fft_mode && !myObj_fft_supported(self))
+    {
+        pd_error(self, "pd.mi.wrps~: the FFT vocoder needs @channels 1 and @oversample 0, using algo 8");
+        self->fft_mode = false;
+    }
+}
+
+void myObj_fft_size(t_myObj *self, float n)
+{
+    // frame size of the FFT vocoder, 256 to 2048 samples (rounded down to a
+    // power of two). Also its latency: larger frames resolve more bands.
+    long size = pdmi::kFftVocoderMinSize;
+    while (size * 2 <= (long)n && size * 2 <= (long)pdmi::kFftVocoderMaxSize)
+        size *= 2;
+    self->fft_size = size;
+    myObj_init_fft_vocoder(self);
+    verbose(3, "fft_size %ld", self->fft_size);
+}
+
+void myObj_fft_bands(t_myObj *self, float n)
+{
+    // number of FFT vocoder bands, 32 to 128
+    self->fft_bands = clamp((long)n, (long)pdmi::kFftVocoderMinBands, (long)pdmi::kFftVocoderMaxBands);
+    myObj_init_fft_vocoder(self);
+    verbose(3, "fft_bands %ld", self->fft_bands);
+}
+
+void myObj_latency(t_myObj *self)
+{
+    if (self->fft_mode)
+    {
+        post("pd.mi.wrps~: fft vocoder, %d bands, latency %ld samples",
+             self->fft_vocoder->num_bands(), self->fft_size);
+        return;
+    }
+    long latency = self->sigvs % self->block_size == 0 ? 0 : self->block_size - 1;
+    if (self->os_factor > 1)
+        latency += 2 * pdmi::kHalfbandOrder - 1;
+    post("pd.mi.wrps~: block size %ld, latency %ld samples", self->block_size, latency);
+}
+
 static void *myObj_new(t_symbol *s, int argc, t_atom *argv)
 {
     t_myObj *self = (t_myObj *)pd_new(this_class);
@@ -104,6 +482,8 @@ static void *myObj_new(t_symbol *s, int argc, t_atom *argv)
 
         // init some params
         self->count = 0;
+        self->block_size = kBlockSize;
+        self->sigvs = sys_getblksize();
         self->easterEgg = 0;
         self->patched[0] = self->patched[1] = 0;
         self->carrier_shape = 1;
@@ -114,17 +494,142 @@ static void *myObj_new(t_symbol *s, int argc, t_atom *argv)
 
         self->modulator->mutable_parameters()->note = 110.0f; // (Hz)
 
+        self->oversample = false;
+        self->os_factor = 1;
+
         self->read_inputs = new warps::ReadInputs;
         self->read_inputs->Init();
 
+        self->vocoder_bus = nullptr;
+        self->vocoder = nullptr;
+        self->vocoder_shared = false;
+
+        self->fft_vocoder = nullptr;
+        self->fft_aux = nullptr;
+        self->fft_aux_position = 0;
+        self->fft_mode = false;
+        self->fft_size = 1024;
+        self->fft_bands = 64;
+
+        self->stats = nullptr;
+        self->nan_resets = 0;
+        self->random_state = pdmi::instance_seed(instance_count++);
+
         for (int i = 0; i < warps::ADC_LAST; i++)
-            self->adc_inputs[i] = 0.0;
+            self->adc_inputs[i] = 0.0f;
+        for (int i = 0; i < 4; i++)
+            self->cv_sum[i] = 0.0;
 
         // TODO: check memory size: should it be warps::kMaxBlockSize?
         self->input_bytes = kBlockSize * sizeof(warps::FloatFrame);
         self->input = (warps::FloatFrame *)getbytes(self->input_bytes);
         self->output_bytes = kBlockSize * sizeof(warps::FloatFrame);
         self->output = (warps::FloatFrame *)getbytes(self->output_bytes);
+        self->os_input = (warps::FloatFrame *)getbytes(2 * self->input_bytes);
+        self->os_output = (warps::FloatFrame *)getbytes(2 * self->output_bytes);
+
+        self->pair[0].modulator = self->modulator;
+        self->pair[0].input = self->input;
+        self->pair[0].output = self->output;
+        self->pair[0].os_input = self->os_input;
+        self->pair[0].os_output = self->os_output;
+        self->channels = 1;
+
+        // attributes ====
+        while (argc > 0)
+        {
+            if (argv->a_type == A_SYMBOL)
+            {
+                t_symbol *curarg = atom_getsymbolarg(0, argc, argv);
+                if (strcmp(curarg->s_name, "@blocksize") == 0)
+                {
+                    if (argc >= 2)
+                    {
+                        t_float argval = atom_getfloatarg(1, argc, argv);
+                        myObj_blocksize(self, argval);
+                        argc -= 2;
+                        argv += 2;
+                    }
+                }
+                else if (strcmp(curarg->s_name, "@oversample") == 0)
+                {
+                    if (argc >= 2)
+                    {
+                        t_float argval = atom_getfloatarg(1, argc, argv);
+                        myObj_oversample(self, argval);
+                        argc -= 2;
+                        argv += 2;
+                    }
+                }
+                else if (strcmp(curarg->s_name, "@channels") == 0)
+                {
+                    if (argc >= 2)
+                    {
+                        t_float argval = atom_getfloatarg(1, argc, argv);
+                        myObj_set_channels(self, argval);
+                        argc -= 2;
+                        argv += 2;
+                    }
+                }
+                else if (strcmp(curarg->s_name, "@fft_size") == 0)
+                {
+                    if (argc >= 2)
+                    {
+                        t_float argval = atom_getfloatarg(1, argc, argv);
+                        myObj_fft_size(self, argval);
+                        argc -= 2;
+                        argv += 2;
+                    }
+                }
+                else if (strcmp(curarg->s_name, "@fft_bands") == 0)
+                {
+                    if (argc >= 2)
+                    {
+                        t_float argval = atom_getfloatarg(1, argc, argv);
+                        myObj_fft_bands(self, argval);
+                        argc -= 2;
+                        argv += 2;
+                    }
+                }
+                else if (strcmp(curarg->s_name, "@timing") == 0)
+                {
+                    if (argc >= 2)
+                    {
+                        t_float argval = atom_getfloatarg(1, argc, argv);
+                        if (argval != 0.f && !self->stats)
+                            self->stats = new pdmi::PerfStats;
+                        argc -= 2;
+                        argv += 2;
+                    }
+                }
+                else if (strcmp(curarg->s_name, "@vocoder_bus") == 0)
+                {
+                    if (argc >= 2)
+                    {
+                        t_symbol *bus = atom_getsymbolarg(1, argc, argv);
+                        if (*bus->s_name)
+                        {
+                            self->vocoder_bus = vocoder_bus_acquire(bus, self->sr);
+                            self->vocoder = new t_vocoder;
+                            self->vocoder->analysis.Init(self->sr);
+                            self->vocoder->synthesis.Init(self->sr);
+                        }
+                        argc -= 2;
+                        argv += 2;
+                    }
+                }
+                else
+                {
+                    argc -= 2;
+                    argv += 2;
+                }
+            }
+            else
+            {
+                argc -= 1;
+                argv += 1;
+            }
+        }
     }
 
     return (void *)self;
@@ -153,6 +658,22 @@ void myObj_info(t_myObj *self)
 void myObj_modulation_algo(t_myObj *self, float m)
 {
     // Selects which signal processing operation is performed on the carrier and modulator.
+    // 0..8 are the warps algorithms, 9 is the FFT vocoder (first channel
+    // pair only, not oversampled, both outlets fft_size samples late).
+    bool fft_mode = m > 8.5f;
+    if (fft_mode && !self->fft_vocoder)
+    {
+        self->fft_vocoder = new pdmi::FftVocoder;
+        self->fft_aux = (float *)getbytes(pdmi::kFftVocoderMaxSize * sizeof(float));
+        myObj_init_fft_vocoder(self);
+    }
+    else if (fft_mode && !self->fft_mode)
+    {
+        self->fft_vocoder->Reset();
+        myObj_reset_fft_aux(self);
+    }
+    self->fft_mode = fft_mode;
+    myObj_check_fft_mode(self);
     m *= 0.125;
     verbose(3, "modulation algo %f", m);
     self->adc_inputs[warps::ADC_ALGORITHM_POT] = clamp(m, 0.0f, 1.0f);
@@ -203,7 +724,8 @@ void myObj_freq(t_myObj *self, float n)
 
 void myObj_bypass(t_myObj *self, float t)
 {
-    self->modulator->set_bypass((int)t != 0);
+    for (long c = 0; c < self->channels; c++)
+        self->pair[c].modulator->set_bypass((int)t != 0);
 }
 
 void myObj_easter_egg(t_myObj *self, float t)
@@ -218,48 +740,363 @@ void myObj_easter_egg(t_myObj *self, float t)
     //        self->modulator->mutable_parameters()->carrier_shape = self->carrier_shape;
     //    }
     self->easterEgg = ((int)t != 0);
-    self->modulator->set_easter_egg(self->easterEgg);
+    for (long c = 0; c < self->channels; c++)
+        self->pair[c].modulator->set_easter_egg(self->easterEgg);
+}
+
+void myObj_seed(t_myObj *self, t_floatarg s)
+{
+    self->random_state = pdmi::seed_state(s);
+}
+
+// runs one pair through Processf, at twice the rate if oversampling
+static void myObj_render_pair(t_myObj *self, t_pair *pair, long size)
+{
+    if (self->os_factor == 1)
+    {
+        pair->modulator->Processf(pair->input, pair->output, size);
+    }
+    else
+    {
+        warps::FloatFrame *os_input = pair->os_input;
+        warps::FloatFrame *os_output = pair->os_output;
+        long os_size = 2 * size;
+
+        pair->upsampler[0].Process(&pair->input[0].l, &os_input[0].l, size, 2);
+        pair->upsampler[1].Process(&pair->input[0].r, &os_input[0].r, size, 2);
+        // two blocks of the configured size, so each stays a multiple of 12
+        for (long offset = 0; offset < os_size; offset += size)
+            pair->modulator->Processf(os_input + offset, os_output + offset, size);
+        pair->downsampler[0].Process(&os_output[0].l, &pair->output[0].l, size, 2);
+        pair->downsampler[1].Process(&os_output[0].r, &pair->output[0].r, size, 2);
+    }
+
+    if (!pdmi::is_finite(&pair->output[0].l, 2 * size))
+    {
+        // NaN or Inf in the modulator or the resamplers: start over with
+        // the same parameters
+        warps::Parameters parameters = *pair->modulator->mutable_parameters();
+        bool bypass = pair->modulator->bypass();
+        pair->modulator->Init(self->sr * self->os_factor);
+        *pair->modulator->mutable_parameters() = parameters;
+        pair->modulator->set_bypass(bypass);
+        pair->modulator->set_easter_egg(self->easterEgg);
+        for (int i = 0; i < 2; i++)
+        {
+            pair->upsampler[i].Init();
+            pair->downsampler[i].Init();
+        }
+        memset(pair->output, 0, size * sizeof(warps::FloatFrame));
+        self->nan_resets++;
+        self->trace.Instant(self, "nan_reset", (int)(pair - self->pair));
+    }
+}
+
+// on a vocoder bus: the modulator's bands for this internal block if pair 0
+// is to run the split vocoder, or null. The first subscriber to run in the
+// tick analyses every block, whether it vocodes or not, for the others.
+static const float *myObj_vocoder_bands(t_myObj *self, long size)
+{
+    t_vocoder *vocoder = self->vocoder;
+    warps::Parameters *p = self->modulator->mutable_parameters();
+    long block = vocoder->block++;
+
+    bool split = p->modulation_algorithm >= 1.0f && p->carrier_shape == 0 && !self->easterEgg &&
+                 !self->modulator->bypass();
+    t_vocoder_bus *bus = self->vocoder_shared ? self->vocoder_bus : nullptr;
+    if (bus && (bus->block_size != size || block >= bus->blocks))
+        bus = nullptr;
+    bool analyse = bus ? vocoder->analyse : split;
+    float *bands = bus ? bus->bands + block * bus->analysis.block_size() : vocoder->bands;
+
+    if (analyse)
+    {
+        float modulator[kBlockSize];
+        self->read_inputs->Ramp(warps::MAPPED_CHANNEL_DRIVE_2, modulator, size);
+        for (long i = 0; i < size; ++i)
+            modulator[i] *= 2.0f * self->pair[0].input[i].r;
+        (bus ? bus->analysis : vocoder->analysis).Process(modulator, size, bands);
+    }
+    return split ? bands : nullptr;
+}
+
+// pair 0 through the carrier half of warps' vocoder. The drives are ramped
+// across the block, as warps::Modulator does on the other paths.
+static void myObj_render_vocoder(t_myObj *self, const float *bands, long size)
+{
+    t_pair *pair = &self->pair[0];
+    warps::Parameters *p = self->modulator->mutable_parameters();
+    pdmi::VocoderSynthesis &synthesis = self->vocoder->synthesis;
+
+    float carrier[kBlockSize];
+    float modulator_drive[kBlockSize];
+    float output[kBlockSize];
+    self->read_inputs->Ramp(warps::MAPPED_CHANNEL_DRIVE_1, carrier, size);
+    self->read_inputs->Ramp(warps::MAPPED_CHANNEL_DRIVE_2, modulator_drive, size);
+    for (long i = 0; i < size; ++i)
+        carrier[i] *= 2.0f * pair->input[i].l;
+    synthesis.set_release(p->modulation_parameter);
+    synthesis.Process(bands, carrier, output, size);
+
+    if (!pdmi::is_finite(output, size))
+    {
+        synthesis.Init(self->sr);
+        memset(output, 0, size * sizeof(float));
+        self->nan_resets++;
+        self->trace.Instant(self, "nan_reset", 0);
+    }
+    for (long i = 0; i < size; ++i)
+    {
+        pair->output[i].l = output[i];
+        pair->output[i].r = pair->input[i].r * 2.0f * modulator_drive[i];
+    }
+}
+
+// runs Processf on the internal block, with the CVs averaged over it
+static void myObj_process_block(t_myObj *self, long size, long channels)
+{
+    float *adc_inputs = self->adc_inputs;
+    double *cv_sum = self->cv_sum;
+
+    // CVs are averaged over the block that Processf is about to render,
+    // so the modulation resolution doesn't depend on the Pd block size
+    for (int idx = 0; idx < 4; idx++)
+    {
+        adc_inputs[idx] = (float)(cv_sum[idx] / size);
+        cv_sum[idx] = 0.0;
+    }
+    warps::Parameters *p = self->modulator->mutable_parameters();
+    self->read_inputs->Read(p, adc_inputs, self->patched, (float)size / warps::ReadInputs::kReferenceBlock);
+
+    const float *bands = self->vocoder ? myObj_vocoder_bands(self, size) : nullptr;
+
+    for (long c = 0; c < channels; c++)
+    {
+        if (c > 0)
+            *self->pair[c].modulator->mutable_parameters() = *p;
+        if (c == 0 && bands)
+            myObj_render_vocoder(self, bands, size);
+        else
+            myObj_render_pair(self, &self->pair[c], size);
+    }
+}
+
+// FFT vocoder on the whole Pd vector, controls read once per vector. aux,
+// the driven modulator, goes through a delay line of the vocoder's latency.
+static void myObj_perform_fft(t_myObj *self, t_sample *carrier_in, t_sample *modulator_in,
+                              t_sample **cv, t_sample *out, t_sample *aux, int vs)
+{
+    warps::Parameters *p = self->modulator->mutable_parameters();
+    float *adc_inputs = self->adc_inputs;
+
+    for (int idx = 0; idx < 4; idx++)
+    {
+        double sum = 0.0;
+        for (int i = 0; i < vs; ++i)
+            sum += cv[idx][i];
+        adc_inputs[idx] = (float)(sum / vs);
+    }
+    self->read_inputs->Read(p, adc_inputs, self->patched, (float)vs / warps::ReadInputs::kReferenceBlock);
+    self->fft_vocoder->set_release(p->modulation_parameter);
+    float carrier_drive = 2.0f * p->channel_drive[0];
+    float modulator_drive = 2.0f * p->channel_drive[1];
+
+    float carrier[kBlockSize];
+    float modulator[kBlockSize];
+    float output[kBlockSize];
+    float *delay = self->fft_aux;
+    long position = self->fft_aux_position;
+    long latency = self->fft_size;
+
+    for (int offset = 0; offset < vs; offset += kBlockSize)
+    {
+        size_t size = std::min((size_t)(vs - offset), kBlockSize);
+        for (size_t i = 0; i < size; ++i)
+        {
+            carrier[i] = carrier_in[offset + i] * carrier_drive;
+            modulator[i] = modulator_in[offset + i] * modulator_drive;
+        }
+        self->fft_vocoder->Process(modulator, carrier, output, size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            out[offset + i] = output[i];
+            aux[offset + i] = delay[position];
+            delay[position] = modulator[i];
+            if (++position == latency)
+                position = 0;
+        }
+    }
+    self->fft_aux_position = position;
 }
 
 static t_int *myObj_perform(t_int *w)
 {
     t_myObj *self = (t_myObj *)(w[1]);
+    pdmi::ScopedFlushDenormals flush;
     t_sample *in1 = (t_sample *)(w[2]);
     t_sample *in2 = (t_sample *)(w[3]);
     t_sample *out = (t_sample *)(w[8]);
     t_sample *aux = (t_sample *)(w[9]);
     int vs = (int)(w[10]);
+    long nchans = (long)(w[11]);    // output channels
+    long in1_chans = (long)(w[12]); // carrier channels
+    long in2_chans = (long)(w[13]); // modulator channels
+    uint64_t trace_begin = self->trace.Begin();
+    pdmi::RandomScope random(self->random_state);
 
-    warps::FloatFrame *input = self->input;
-    warps::FloatFrame *output = self->output;
+    t_sample *cv[4] = {
+        (t_sample *)(w[4]), // level 1
+        (t_sample *)(w[5]), // level 2
+        (t_sample *)(w[6]), // algo
+        (t_sample *)(w[7]), // timbre
+    };
 
-    long count = self->count;
-    double *adc_inputs = self->adc_inputs;
+    if (self->fft_mode)
+    {
+        // only allowed with a single pair
+        myObj_perform_fft(self, in1, in2, cv, out, aux, vs);
+        for (long c = 1; c < nchans; c++)
+        {
+            memset(out + c * vs, 0, vs * sizeof(t_sample));
+            memset(aux + c * vs, 0, vs * sizeof(t_sample));
+        }
+        self->trace.EndPerform(self, trace_begin);
+        return (w + 14);
+    }
 
-    for (int idx = 0; idx < 4; idx++)
+    if (self->vocoder)
     {
-        adc_inputs[idx] = ((t_sample *)w[idx + 4])[0];
+        self->vocoder->block = 0;
+        self->vocoder->analyse = self->vocoder_shared && vocoder_bus_claim(self->vocoder_bus);
     }
-    self->read_inputs->Read(self->modulator->mutable_parameters(), adc_inputs, self->patched);
 
-    for (int i = 0; i < vs; ++i)
+    long channels = std::min(nchans, self->channels);
+    long block_size = self->block_size;
+    double *cv_sum = self->cv_sum;
+    long count = self->count;
+
+    // aligned: count stays 0 and blocks are processed in place, with no
+    // added latency. Otherwise the block FIFO delays by block_size - 1.
+    bool aligned = vs % block_size == 0;
+
+    for (int i = 0; i < vs;)
     {
-        input[count].l = in1[i];
-        input[count].r = in2[i];
+        long n = std::min(block_size - count, (long)(vs - i));
 
-        count++;
-        if (count >= kBlockSize)
+        for (int idx = 0; idx < 4; idx++)
         {
-            self->modulator->Processf(input, output, kBlockSize);
+            for (long j = 0; j < n; ++j)
+                cv_sum[idx] += cv[idx][i + j];
+        }
+        for (long c = 0; c < channels; c++)
+        {
+            warps::FloatFrame *input = self->pair[c].input + count;
+            t_sample *l = in1 + (c % in1_chans) * vs + i;
+            t_sample *r = in2 + (c % in2_chans) * vs + i;
+            for (long j = 0; j < n; ++j)
+            {
+                input[j].l = l[j];
+                input[j].r = r[j];
+            }
+        }
+        if (!aligned)
+        {
+            for (long c = 0; c < channels; c++)
+            {
+                warps::FloatFrame *output = self->pair[c].output + count + 1;
+                for (long j = 0; j < n - 1; ++j)
+                {
+                    out[c * vs + i + j] = output[j].l;
+                    aux[c * vs + i + j] = output[j].r;
+                }
+            }
+        }
+
+        count += n;
+        if (count >= block_size)
+        {
+            myObj_process_block(self, block_size, channels);
             count = 0;
         }
 
-        out[i] = output[count].l;
-        aux[i] = output[count].r;
+        for (long c = 0; c < channels; c++)
+        {
+            warps::FloatFrame *output = self->pair[c].output;
+            if (aligned)
+            {
+                for (long j = 0; j < n; ++j)
+                {
+                    out[c * vs + i + j] = output[j].l;
+                    aux[c * vs + i + j] = output[j].r;
+                }
+            }
+            else
+            {
+                out[c * vs + i + n - 1] = output[count].l;
+                aux[c * vs + i + n - 1] = output[count].r;
+            }
+        }
+        i += n;
+    }
+    for (long c = channels; c < nchans; c++)
+    {
+        memset(out + c * vs, 0, vs * sizeof(t_sample));
+        memset(aux + c * vs, 0, vs * sizeof(t_sample));
     }
 
     self->count = count;
-    return (w + 11);
+    self->trace.EndPerform(self, trace_begin);
+    return (w + 14);
+}
+
+static t_int *myObj_perform_timed(t_int *w)
+{
+    t_myObj *self = (t_myObj *)(w[1]);
+    uint64_t start = pdmi::perf_ticks();
+    t_int *next = myObj_perform(w);
+    if (self->stats)
+        self->stats->Add(pdmi::perf_ticks() - start, (int)(w[10]));
+    return next;
+}
+
+#pragma mark----- timing -----
+
+void myObj_timing(t_myObj *self, t_floatarg t)
+{
+    bool on = t != 0.f;
+    if (on == (self->stats != nullptr))
+        return;
+    if (on)
+        self->stats = new pdmi::PerfStats;
+    else
+    {
+        delete self->stats;
+        self->stats = nullptr;
+    }
+    // swap the perform routine
+    canvas_update_dsp();
+}
+
+// all channels together, ns per Pd vector
+void myObj_stats(t_myObj *self)
+{
+    post("pd.mi.wrps~: %ld NaN resets", self->nan_resets);
+    if (self->stats)
+        pdmi::perf_post("pd.mi.wrps~", self->stats->Summarize(self->sr));
+    else
+        post("pd.mi.wrps~: timing is off, send 'timing 1' first");
+}
+
+void myObj_stats_reset(t_myObj *self)
+{
+    self->nan_resets = 0;
+    if (self->stats)
+        self->stats->Reset();
+}
+
+void myObj_trace_dump(t_myObj *self, t_symbol *file)
+{
+    pdmi::trace_dump((t_object *)self, "pd.mi.wrps~", file);
 }
 
 static void myObj_dsp(t_myObj *self, t_signal **sp)
@@ -268,9 +1105,41 @@ static void myObj_dsp(t_myObj *self, t_signal **sp)
     if (samplerate != self->sr)
     {
         self->sr = samplerate;
-        self->modulator->Init(self->sr);
+        myObj_init_modulator(self);
+        myObj_init_fft_vocoder(self);
     }
-    dsp_add(myObj_perform, 10 /* x+inlets+outlets+s_n */,
+    if (sp[0]->s_n != self->sigvs)
+    {
+        self->sigvs = sp[0]->s_n;
+        myObj_blocksize(self, self->block_size);
+    }
+    if (self->vocoder_bus)
+    {
+        // all subscribers start their internal blocks here, together
+        myObj_blocksize(self, self->block_size);
+        self->vocoder->analysis.Init(self->sr);
+        self->vocoder->synthesis.Init(self->sr);
+        self->vocoder_shared = vocoder_bus_prepare(self->vocoder_bus, sp[0]->s_n, self->block_size, self->sr);
+        if (!self->vocoder_shared)
+            pd_error((t_object *)self, "vocoder bus %s: vector/block size mismatch (%d/%ld vs %ld/%ld), using own analysis",
+                     self->vocoder_bus->name->s_name, sp[0]->s_n, self->block_size, self->vocoder_bus->vs,
+                     self->vocoder_bus->block_size);
+    }
+    if (self->sigvs % self->block_size != 0 && self->block_size != kBlockSize)
+    {
+        logpost(self, 3, "pd.mi.wrps~: block size %ld doesn't divide %d, adding %ld samples latency",
+                self->block_size, self->sigvs, self->block_size - 1);
+    }
+    long nchans = 1, in1_chans = 1, in2_chans = 1;
+#ifdef CLASS_MULTICHANNEL
+    nchans = self->channels;
+    in1_chans = sp[0]->s_nchans;
+    in2_chans = sp[1]->s_nchans;
+    signal_setmultiout(&sp[6], nchans);
+    signal_setmultiout(&sp[7], nchans);
+#endif
+
+    dsp_add(self->stats ? myObj_perform_timed : myObj_perform, 13 /* x+inlets+outlets+s_n+channels */,
             self,
             sp[0]->s_vec, // 6 inlets
             sp[1]->s_vec,
@@ -280,7 +1149,10 @@ static void myObj_dsp(t_myObj *self, t_signal **sp)
             sp[5]->s_vec,
             sp[6]->s_vec, // 2 outlets
             sp[7]->s_vec,
-            sp[0]->s_n);
+            sp[0]->s_n,
+            nchans,
+            in1_chans,
+            in2_chans);
 }
 
 // plug / unplug patch chords...
@@ -320,9 +1192,21 @@ static void myObj_free(t_myObj *self)
     outlet_free(self->m_out);
     outlet_free(self->m_aux);
     delete self->modulator;
+    for (long c = 1; c < self->channels; c++)
+        myObj_pair_free(self, &self->pair[c]);
+    delete self->read_inputs;
+    if (self->vocoder_bus)
+        vocoder_bus_release(self->vocoder_bus);
+    delete self->vocoder;
+    delete self->fft_vocoder;
+    if (self->fft_aux)
+        freebytes(self->fft_aux, pdmi::kFftVocoderMaxSize * sizeof(float));
+    delete self->stats;
 
     freebytes(self->input, self->input_bytes);
     freebytes(self->output, self->output_bytes);
+    freebytes(self->os_input, 2 * self->input_bytes);
+    freebytes(self->os_output, 2 * self->output_bytes);
 }
 
 extern "C"
@@ -331,7 +1215,11 @@ extern "C"
     {
         this_class = class_new(gensym("pd.mi.wrps~"),
                                (t_newmethod)myObj_new, (t_method)myObj_free,
+#ifdef CLASS_MULTICHANNEL
+                               sizeof(t_myObj), CLASS_MULTICHANNEL, A_GIMME, 0);
+#else
                                sizeof(t_myObj), CLASS_DEFAULT, A_GIMME, 0);
+#endif
         class_addcreator(
             (t_newmethod)myObj_new,
             gensym("mi/wrps~"),
@@ -353,12 +1241,27 @@ extern "C"
 
             class_addmethod(this_class, (t_method)myObj_bypass, gensym("bypass"), A_FLOAT, 0);
             class_addmethod(this_class, (t_method)myObj_easter_egg, gensym("easteregg"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_seed, gensym("seed"), A_FLOAT, 0);
             class_addmethod(this_class, (t_method)myObj_plug, gensym("plug"), A_GIMME, 0);
             class_addmethod(this_class, (t_method)myObj_info, gensym("info"), A_GIMME, 0);
+            class_addmethod(this_class, (t_method)myObj_blocksize, gensym("blocksize"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_latency, gensym("latency"), A_NULL);
+            class_addmethod(this_class, (t_method)myObj_oversample, gensym("oversample"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_vocoder_bus, gensym("vocoder_bus"), A_DEFSYMBOL, 0);
+            class_addmethod(this_class, (t_method)myObj_channels, gensym("channels"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_fft_size, gensym("fft_size"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_fft_bands, gensym("fft_bands"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_timing, gensym("timing"), A_FLOAT, 0);
+            class_addmethod(this_class, (t_method)myObj_stats, gensym("stats"), A_NULL);
+            class_addmethod(this_class, (t_method)myObj_stats_reset, gensym("stats_reset"), A_NULL);
+            class_addmethod(this_class, (t_method)myObj_trace_dump, gensym("trace_dump"), A_DEFSYMBOL, 0);
+            pdmi::trace_setup();
 
+#ifndef PD_MI_LIBRARY
             post("pd.mi.wrps~ by przemysław sanecki --> https://software-materialism.org");
             post("vb.mi.wrps~ by volker böhm --> https://vboehm.net");
             post("a clone of mutable instruments' 'warps' module");
+#endif
         }
     }
 }
\ No newline at end of file
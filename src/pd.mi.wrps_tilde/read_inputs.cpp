@@ -9,7 +9,11 @@
 
 #include <algorithm>
 #include <cmath>
-//#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define READ_INPUTS_SSE2 1
+#endif
 
 #include "stmlib/dsp/dsp.h"
 #include "stmlib/utils/random.h"
@@ -23,13 +27,16 @@ namespace warps {
     using namespace stmlib;
     
     void ReadInputs::Init() {
-        note_cv_ = 0.0;
-        note_pot_ = 0.0;
-        fill(&lp_state_[0], &lp_state_[ADC_LAST], 0.0);
+        fill(&lp_state_[0], &lp_state_[ADC_LAST], 0.0f);
+        fill(&value_[0], &value_[MAPPED_LAST], 0.0f);
+        fill(&previous_value_[0], &previous_value_[MAPPED_LAST], 0.0f);
+        // CVs 0.08, pots 0.33 * 0.08 per reference block
+        fill(&lp_coefficient_[ADC_LEVEL_1_CV], &lp_coefficient_[ADC_LEVEL_1_POT], 0.08f);
+        fill(&lp_coefficient_[ADC_LEVEL_1_POT], &lp_coefficient_[ADC_LAST], 0.33f * 0.08f);
     }
     
-    double ReadInputs::UnwrapPot(double x) const {
-        return Interpolate(lut_pot_curve, x, 512.0);        
+    float ReadInputs::UnwrapPot(float x) const {
+        return Interpolate(lut_pot_curve, x, 512.0f);
     }
  /*
 #define BIND(destination, NAME, unwrap, scale, lp_coefficient, attenuate) \
@@ -44,99 +51,85 @@ namespace warps {
     destination = value; \
 }
    */
-#define BIND(destination, NAME, unwrap, scale, lp_coefficient, attenuate) \
-{ \
-    lp_state_[ADC_ ## NAME ## _POT] += 0.33 * lp_coefficient * (adc_inputs[ADC_ ## NAME ## _POT] - lp_state_[ADC_ ## NAME ## _POT]); \
-    lp_state_[ADC_ ## NAME ## _CV] += lp_coefficient * (adc_inputs[ADC_ ## NAME ## _CV] - lp_state_[ADC_ ## NAME ## _CV]); \
-    double pot = lp_state_[ADC_ ## NAME ## _POT]; \
-    double cv = lp_state_[ADC_ ## NAME ## _CV]; \
-    double value = attenuate ? (pot * pot * cv * scale) : (pot + cv * scale); \
-    CONSTRAIN(value, 0.0, 1.0); \
-    destination = value; \
-}
     
-    void ReadInputs::Read(Parameters* p, double *adc_inputs, short* patched) {
-        // Modulation parameters.
-//        BIND(p->channel_drive[0], LEVEL_1, false, 1.6, 0.08, true);     // unipolar input?
-//        BIND(p->channel_drive[1], LEVEL_2, false, 1.6, 0.08, true);     // unipolar input?
-//        BIND(p->modulation_algorithm, ALGORITHM, false, 1.0, 0.08, false);  // unwrap was true, vb
-//        BIND(p->modulation_parameter, PARAMETER, false, 1.0, 0.08, false);
-        
-        // 2x level --> channel drive
-        for (int32_t i = 0; i < 2; ++i) {
-            int index_pot = ADC_LEVEL_1_POT + i;
-            int index_cv = ADC_LEVEL_1_CV + i;
-            lp_state_[index_pot] += 0.33 * 0.08 * (adc_inputs[index_pot] - lp_state_[index_pot]);
-            lp_state_[index_cv] += 0.08 * (adc_inputs[index_cv] - lp_state_[index_cv]);
-            
-            double pot = lp_state_[index_pot];
-            if (!patched[i]) {
-               p->channel_drive[i] = pot * pot;
-            }
-            else {
-                double cv = lp_state_[index_cv];
-                double value = (pot * pot * cv * 1.6);
-                CONSTRAIN(value, 0.0, 1.0);
-                p->channel_drive[i] = value;
-            }
+    void ReadInputs::Read(Parameters* p, const float *adc_inputs, const short* patched, float steps) {
+        // n steps of lp += c * (in - lp) toward a constant input move the
+        // state by 1 - (1 - c)^n of the distance
+        alignas(16) float coefficient[ADC_LAST];
+        if (steps == 1.0f) {
+            copy(&lp_coefficient_[0], &lp_coefficient_[ADC_LAST], &coefficient[0]);
+        } else {
+            coefficient[ADC_LEVEL_1_CV] = 1.0f - powf(1.0f - lp_coefficient_[ADC_LEVEL_1_CV], steps);
+            coefficient[ADC_LEVEL_1_POT] = 1.0f - powf(1.0f - lp_coefficient_[ADC_LEVEL_1_POT], steps);
+            fill(&coefficient[ADC_LEVEL_1_CV], &coefficient[ADC_LEVEL_1_POT], coefficient[ADC_LEVEL_1_CV]);
+            fill(&coefficient[ADC_LEVEL_1_POT], &coefficient[ADC_LAST], coefficient[ADC_LEVEL_1_POT]);
         }
         
+        // lanes: drive 1, drive 2, algorithm, parameter (MappedParameter)
+        float *value = value_;
+        copy(&value_[0], &value_[MAPPED_LAST], &previous_value_[0]);
+        // drives are pot^2 * cv * 1.6 when patched, pot^2 otherwise;
+        // algorithm and parameter are pot + cv
+        alignas(16) static const float kMultiply[4] = { 1.0f, 1.0f, 0.0f, 0.0f };
+        alignas(16) float unpatched[4] = {
+            patched[0] ? 0.0f : 1.0f, patched[1] ? 0.0f : 1.0f, 0.0f, 0.0f };
         
-        // algorithm
-        lp_state_[ADC_ALGORITHM_POT] += 0.33 * 0.08 * (adc_inputs[ADC_ALGORITHM_POT] - lp_state_[ADC_ALGORITHM_POT]);
-        lp_state_[ADC_ALGORITHM_CV] += 0.08 * (adc_inputs[ADC_ALGORITHM_CV] - lp_state_[ADC_ALGORITHM_CV]);
-        double pot = lp_state_[ADC_ALGORITHM_POT];
-        //pot = UnwrapPot(pot);
-        double cv = lp_state_[ADC_ALGORITHM_CV];
-        double value = (pot + cv);
-        CONSTRAIN(value, 0.0, 1.0);
-        p->modulation_algorithm = value;
+#ifdef READ_INPUTS_SSE2
+        __m128 previous_cv = _mm_load_ps(&lp_state_[ADC_LEVEL_1_CV]);
+        __m128 previous_pot = _mm_load_ps(&lp_state_[ADC_LEVEL_1_POT]);
+        __m128 cv = _mm_add_ps(previous_cv, _mm_mul_ps(_mm_load_ps(&coefficient[ADC_LEVEL_1_CV]),
+            _mm_sub_ps(_mm_loadu_ps(&adc_inputs[ADC_LEVEL_1_CV]), previous_cv)));
+        __m128 pot = _mm_add_ps(previous_pot, _mm_mul_ps(_mm_load_ps(&coefficient[ADC_LEVEL_1_POT]),
+            _mm_sub_ps(_mm_loadu_ps(&adc_inputs[ADC_LEVEL_1_POT]), previous_pot)));
+        _mm_store_ps(&lp_state_[ADC_LEVEL_1_CV], cv);
+        _mm_store_ps(&lp_state_[ADC_LEVEL_1_POT], pot);
         
-        // timbre/parameter
-        lp_state_[ADC_PARAMETER_POT] += 0.33 * 0.08 * (adc_inputs[ADC_PARAMETER_POT] - lp_state_[ADC_PARAMETER_POT]);
-        lp_state_[ADC_PARAMETER_CV] += 0.08 * (adc_inputs[ADC_PARAMETER_CV] - lp_state_[ADC_PARAMETER_CV]);
-        pot = lp_state_[ADC_PARAMETER_POT];
-        cv = lp_state_[ADC_PARAMETER_CV];
-        value = (pot + cv);
-        CONSTRAIN(value, 0.0, 1.0);
-        p->modulation_parameter = value;
+        __m128 square = _mm_mul_ps(pot, pot);
+        __m128 product = _mm_mul_ps(_mm_mul_ps(square, cv), _mm_set1_ps(1.6f));
+        __m128 sum = _mm_add_ps(pot, cv);
+        __m128 multiply = _mm_cmpgt_ps(_mm_load_ps(kMultiply), _mm_setzero_ps());
+        __m128 use_square = _mm_cmpgt_ps(_mm_load_ps(unpatched), _mm_setzero_ps());
+        __m128 mapped = _mm_or_ps(_mm_and_ps(multiply, product), _mm_andnot_ps(multiply, sum));
+        mapped = _mm_or_ps(_mm_and_ps(use_square, square), _mm_andnot_ps(use_square, mapped));
+        mapped = _mm_min_ps(_mm_max_ps(mapped, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+        _mm_store_ps(value, mapped);
+#else
+        for (int i = 0; i < ADC_LAST; ++i) {
+            lp_state_[i] += coefficient[i] * (adc_inputs[i] - lp_state_[i]);
+        }
+        for (int i = 0; i < 4; ++i) {
+            float cv = lp_state_[ADC_LEVEL_1_CV + i];
+            float pot = lp_state_[ADC_LEVEL_1_POT + i];
+            float square = pot * pot;
+            float mapped = kMultiply[i] > 0.0f ? square * cv * 1.6f : pot + cv;
+            mapped = unpatched[i] > 0.0f ? square : mapped;
+            value[i] = mapped < 0.0f ? 0.0f : (mapped > 1.0f ? 1.0f : mapped);
+        }
+#endif
         
+        p->channel_drive[0] = value[0];
+        p->channel_drive[1] = value[1];
+        p->modulation_algorithm = value[2];
+        p->modulation_parameter = value[3];
         
         // Easter egg parameter mappings.
         p->frequency_shift_pot = lp_state_[ADC_ALGORITHM_POT];
         float frequency_shift_cv = lp_state_[ADC_ALGORITHM_CV];
         p->frequency_shift_cv = frequency_shift_cv * 0.5f;  // vb, range is too wide!
-        CONSTRAIN(p->frequency_shift_cv, -1.0, 1.0);
+        CONSTRAIN(p->frequency_shift_cv, -1.0f, 1.0f);
         
-        double phase_shift = lp_state_[ADC_ALGORITHM_POT] + frequency_shift_cv;
-        CONSTRAIN(phase_shift, 0.0, 1.0);
+        float phase_shift = lp_state_[ADC_ALGORITHM_POT] + frequency_shift_cv;
+        CONSTRAIN(phase_shift, 0.0f, 1.0f);
         p->phase_shift = phase_shift;
-        
-        
-        // Internal oscillator parameters.
-//        double note;
-//        note = adc_inputs[ADC_LEVEL_1_CV] * 60.f;
-//        double interval = note - note_cv_;
-//        if (interval < -0.4 || interval > 0.4) {
-//            note_cv_ = note;
-//        } else {
-//            note_cv_ += 0.1 * interval;
-//        }
-//
-//        note = 60.0 * adc_inputs[ADC_LEVEL_1_POT] + 12.0;
-//        note_pot_ += 0.1 * (note - note_pot_);
-//        p->note = note_pot_ + note_cv_;
-//
-        // if not patched! this overrides the 'BIND' above!
-//        for (int32_t i = 0; i < 2; ++i) {
-//            if (!patched[i]) {
-//                double pot = lp_state_[ADC_LEVEL_1_POT + i];
-//                p->channel_drive[i] = pot * pot;
-//            }
-//        }
-//        if (!patched[0]) {
-//            p->note = note_pot_ + 24.0;
-//        }
+    }
+    
+    void ReadInputs::Ramp(MappedParameter parameter, float *out, size_t size) const {
+        float value = previous_value_[parameter];
+        float increment = (value_[parameter] - value) / static_cast<float>(size);
+        for (size_t i = 0; i < size; ++i) {
+            value += increment;
+            out[i] = value;
+        }
     }
     
 }
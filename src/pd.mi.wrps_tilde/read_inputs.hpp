@@ -11,6 +11,8 @@
 #include <m_pd.h>
 #include "stmlib/stmlib.h"
 
+#include <cstddef>
+
 namespace warps {
     
     enum AdcChannel {
@@ -25,42 +27,55 @@ namespace warps {
         ADC_LAST
     };
     
-    class Parameters;
+    // the four parameters Read maps the channels to, in its lane order
+    enum MappedParameter {
+        MAPPED_CHANNEL_DRIVE_1,
+        MAPPED_CHANNEL_DRIVE_2,
+        MAPPED_MODULATION_ALGORITHM,
+        MAPPED_MODULATION_PARAMETER,
+        MAPPED_LAST
+    };
     
+    class Parameters;
     
+    // The eight control channels are smoothed as one vector: CVs in lanes
+    // 0-3, pots in lanes 4-7, so the mapping below works on two 4-wide
+    // halves that line up parameter by parameter.
     class ReadInputs {
     public:
         ReadInputs() { }
         ~ReadInputs() { }
         
         void Init();
-        void Read(Parameters* parameters, double *adc_inputs, short* patched);
+        // steps: length of the block in reference blocks (kReferenceBlock
+        // samples), the smoothing is advanced in closed form so its time
+        // constant doesn't depend on the block size
+        void Read(Parameters* parameters, const float *adc_inputs, const short* patched, float steps = 1.0f);
+        // linear ramp of one mapped parameter from the Read before the
+        // last one to the last, ending on the last value: for the block
+        // the last Read was for, wherever the wrapper applies a parameter
+        // per sample itself
+        void Ramp(MappedParameter parameter, float *out, size_t size) const;
         inline uint8_t easter_egg_digit() const {
-            if (lp_state_[ADC_LEVEL_1_POT] < 0.05 && \
-                lp_state_[ADC_LEVEL_2_POT] < 0.05 && \
-                lp_state_[ADC_PARAMETER_POT] < 0.05) {
+            if (lp_state_[ADC_LEVEL_1_POT] < 0.05f && \
+                lp_state_[ADC_LEVEL_2_POT] < 0.05f && \
+                lp_state_[ADC_PARAMETER_POT] < 0.05f) {
                 return static_cast<uint8_t>(
-                                            UnwrapPot(lp_state_[ADC_ALGORITHM_POT]) * 8.0 + 0.5);
+                                            UnwrapPot(lp_state_[ADC_ALGORITHM_POT]) * 8.0f + 0.5f);
             } else {
                 return 0;
             }
         }
       
-        double UnwrapPot(double x) const;
+        float UnwrapPot(float x) const;
         
-    private:
-        void DetectNormalization();
-        
-
-//        CalibrationData* calibration_data_;
-        
-        double lp_state_[ADC_LAST];
-        double note_cv_;
-        double note_pot_;
-        double note_pot_quantized_;
-        double cv_c1_;
-        double cv_low_[2];
+        static const size_t kReferenceBlock = 96;
         
+    private:
+        alignas(16) float lp_state_[ADC_LAST];
+        alignas(16) float value_[MAPPED_LAST];
+        alignas(16) float previous_value_[MAPPED_LAST];
+        alignas(16) float lp_coefficient_[ADC_LAST];
         
         DISALLOW_COPY_AND_ASSIGN(ReadInputs);
     };
@@ -0,0 +1,177 @@
+//
+//  split_vocoder.hpp
+//  pd-mi
+//
+
+// warps' vocoder split into its analysis and synthesis halves, so that one
+// modulator analysis can drive any number of carriers (see the vocoder bus
+// in pd.mi.wrps_tilde.cpp).
+//
+// warps::Vocoder runs two warps::FilterBank: one splits the modulator into
+// bands, the other splits the carrier, whose bands are scaled by envelope
+// followers on the modulator's bands and summed back by the bank. Both
+// banks are private to warps::Modulator, but FilterBank itself is public.
+// VocoderAnalysis runs the modulator's bank and copies its band signals
+// out; VocoderSynthesis runs a carrier bank of its own on them, with its
+// own followers.
+//
+// The bank decimates its lower bands by 3 and 4, so blocks are a multiple
+// of kVocoderBlockMultiple samples, and at most kMaxFilterBankBlockSize.
+// Analysed bands are laid out band after band, each band with as many
+// samples as it has in the block (see VocoderBandLayout).
+
+#ifndef split_vocoder_hpp
+#define split_vocoder_hpp
+
+#include "warps/dsp/filter_bank.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+namespace pdmi
+{
+
+const size_t kVocoderBlockMultiple = 12;
+
+// room for the analysed bands of one block, whatever the decimation
+const size_t kVocoderMaxBandSamples = warps::kNumBands * warps::kMaxFilterBankBlockSize;
+
+struct VocoderBandLayout
+{
+    int decimation[warps::kNumBands];
+    size_t offset[warps::kNumBands]; // of each band in the analysed block
+    size_t size;                     // of a full block of analysed bands
+
+    void Init(warps::FilterBank &bank)
+    {
+        size = 0;
+        for (int i = 0; i < warps::kNumBands; ++i)
+        {
+            decimation[i] = bank.band(i).decimation_factor;
+            offset[i] = size;
+            size += warps::kMaxFilterBankBlockSize / decimation[i];
+        }
+    }
+};
+
+class VocoderAnalysis
+{
+public:
+    void Init(float sample_rate)
+    {
+        bank_.Init(sample_rate);
+        layout_.Init(bank_);
+    }
+
+    // floats per analysed block
+    size_t block_size() const { return layout_.size; }
+
+    void Process(const float *modulator, size_t size, float *bands)
+    {
+        bank_.Analyze(modulator, size);
+        for (int i = 0; i < warps::kNumBands; ++i)
+            memcpy(bands + layout_.offset[i], bank_.band(i).samples,
+                   size / layout_.decimation[i] * sizeof(float));
+    }
+
+private:
+    warps::FilterBank bank_;
+    VocoderBandLayout layout_;
+};
+
+class VocoderSynthesis
+{
+public:
+    void Init(float sample_rate)
+    {
+        sample_rate_ = sample_rate;
+        bank_.Init(sample_rate);
+        layout_.Init(bank_);
+        for (int i = 0; i < warps::kNumBands; ++i)
+            envelope_[i] = gain_[i] = 0.f;
+        release_ = -1.f;
+        set_release(0.5f);
+    }
+
+    // warps' TIMBRE in vocoder mode: 0..1 maps to a release of 10 ms..1 s,
+    // and the top of the range freezes the envelopes
+    void set_release(float release)
+    {
+        if (release == release_)
+            return;
+        release_ = release;
+        freeze_ = release > 0.995f;
+        float release_time = 0.01f * exp2f(release * 6.64386f);
+        for (int i = 0; i < warps::kNumBands; ++i)
+        {
+            float band_rate = sample_rate_ / static_cast<float>(layout_.decimation[i]);
+            attack_[i] = 1.0f - expf(-1.0f / (0.002f * band_rate));
+            decay_[i] = 1.0f - expf(-1.0f / (release_time * band_rate));
+        }
+    }
+
+    // bands: one block from VocoderAnalysis::Process, of the same size.
+    // out is overwritten.
+    void Process(const float *bands, const float *carrier, float *out, size_t size)
+    {
+        bank_.Analyze(carrier, size);
+        for (int i = 0; i < warps::kNumBands; ++i)
+        {
+            size_t band_size = size / layout_.decimation[i];
+            const float *modulator = bands + layout_.offset[i];
+
+            float envelope = envelope_[i];
+            if (!freeze_)
+            {
+                float attack = attack_[i];
+                float decay = decay_[i];
+                for (size_t j = 0; j < band_size; ++j)
+                {
+                    float error = fabsf(modulator[j]) - envelope;
+                    envelope += (error > 0.f ? attack : decay) * error;
+                }
+                envelope_[i] = envelope;
+            }
+
+            // ramp the gain across the block
+            float *samples = bank_.band(i).samples;
+            float gain = gain_[i];
+            float target = envelope * kMakeup;
+            float increment = (target - gain) / static_cast<float>(band_size);
+            for (size_t j = 0; j < band_size; ++j)
+            {
+                gain += increment;
+                samples[j] *= gain;
+            }
+            gain_[i] = target;
+        }
+        bank_.Synthesize(out, size);
+
+        for (size_t i = 0; i < size; ++i)
+            out[i] = SoftLimit(out[i]);
+    }
+
+private:
+    static constexpr float kMakeup = 16.0f;
+
+    static inline float SoftLimit(float x)
+    {
+        x = x < -3.f ? -3.f : x > 3.f ? 3.f : x;
+        return x * (27.f + x * x) / (27.f + 9.f * x * x);
+    }
+
+    warps::FilterBank bank_;
+    VocoderBandLayout layout_;
+    float sample_rate_;
+    float release_;
+    bool freeze_;
+    float attack_[warps::kNumBands];
+    float decay_[warps::kNumBands];
+    float envelope_[warps::kNumBands];
+    float gain_[warps::kNumBands];
+};
+
+} // namespace pdmi
+
+#endif /* split_vocoder_hpp */